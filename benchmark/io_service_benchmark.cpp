@@ -0,0 +1,1377 @@
+﻿#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "boost/asio/io_context.hpp"
+#include "boost/asio/ip/tcp.hpp"
+#include "boost/beast/core/flat_buffer.hpp"
+#include "boost/beast/websocket.hpp"
+#include "function_view.h"
+#include "inplace_function.h"
+#include "io_service.h"
+#include "io_service_group.h"
+#include "parallel_for.h"
+#include "sequenced_task_runner.h"
+#include "trace.h"
+#include "unique_function.h"
+
+using namespace bee;
+
+// Counting allocator, counts heap allocations while enabled. Keep the
+// replacements out of line, or gcc warns about new/free mismatch after
+// inlining them.
+#if defined(__GNUC__)
+#define BENCHMARK_NOINLINE __attribute__((noinline))
+#else
+#define BENCHMARK_NOINLINE
+#endif
+
+static std::atomic<bool> g_count_allocations(false);
+static std::atomic<int64_t> g_allocations(0);
+
+BENCHMARK_NOINLINE void* operator new(size_t size) {
+  if (g_count_allocations.load(std::memory_order_relaxed)) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+  }
+  void* p = malloc(size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+BENCHMARK_NOINLINE void operator delete(void* p) noexcept {
+  free(p);
+}
+
+namespace {
+
+const int32_t kTotalTasks = 1600000;
+
+typedef std::chrono::steady_clock Clock;
+
+// One measured value, collected for JSON output.
+struct Metric {
+  std::string benchmark;
+  std::string name;
+  double value;
+  std::string unit;
+};
+
+std::vector<Metric> g_metrics;
+const char* g_benchmark = "";
+
+// Record a value of the running benchmark, tables are still printed by each
+// benchmark for reading.
+void Record(const std::string& name, double value, const char* unit) {
+  Metric metric = {g_benchmark, name, value, unit};
+  g_metrics.push_back(metric);
+}
+
+// Write |g_metrics| to |path| as JSON, return false if failed.
+bool WriteJson(const char* path) {
+  FILE* file = fopen(path, "w");
+  if (file == nullptr) {
+    return false;
+  }
+  fprintf(file, "{\n  \"context\": {\"hardware_concurrency\": %u},\n",
+          std::thread::hardware_concurrency());
+  fprintf(file, "  \"metrics\": [\n");
+  for (size_t i = 0; i < g_metrics.size(); ++i) {
+    const Metric& metric = g_metrics[i];
+    fprintf(file,
+            "    {\"benchmark\": \"%s\", \"name\": \"%s\", \"value\": %.6g, "
+            "\"unit\": \"%s\"}%s\n",
+            metric.benchmark.c_str(), metric.name.c_str(), metric.value,
+            metric.unit.c_str(), (i + 1 < g_metrics.size()) ? "," : "");
+  }
+  fprintf(file, "  ]\n}\n");
+  fclose(file);
+  return true;
+}
+
+// Return percentile |p| of sorted |values|.
+int64_t Percentile(const std::vector<int64_t>& values, int32_t p) {
+  if (values.empty()) {
+    return 0;
+  }
+  return values[std::min(values.size() - 1, values.size() * p / 100)];
+}
+
+// The io_context post path used by IOService before TaskScheduler, every task
+// is a FunctorPost in shared_ptr posted to io_context directly.
+class LegacyPoster {
+ public:
+  LegacyPoster()
+      : work_(new boost::asio::io_context::work(ioc_)),
+        thread_([this] { ioc_.run(); }) {}
+
+  ~LegacyPoster() {
+    work_.reset();
+    thread_.join();
+  }
+
+  template <class FunctorT>
+  void PostTask(FunctorT&& functor) {
+    FunctorWrapper* p =
+        new FunctorPost<FunctorT>(std::forward<FunctorT>(functor));
+    std::shared_ptr<FunctorWrapper> functor_wrapper(p);
+    ioc_.post([functor_wrapper] { functor_wrapper->run(); });
+  }
+
+ private:
+  boost::asio::io_context ioc_;
+  std::unique_ptr<boost::asio::io_context::work> work_;
+  std::thread thread_;
+};
+
+// Post kTotalTasks tasks from |producers| threads, return tasks per second.
+template <class PosterT>
+double RunPostTask(PosterT& poster, int32_t producers) {
+  std::atomic<int32_t> executed(0);
+  int32_t tasks_per_producer = kTotalTasks / producers;
+  int32_t total = tasks_per_producer * producers;
+
+  Clock::time_point start = Clock::now();
+  std::vector<std::thread> threads;
+  for (int32_t i = 0; i < producers; ++i) {
+    threads.emplace_back([&poster, &executed, tasks_per_producer] {
+      for (int32_t j = 0; j < tasks_per_producer; ++j) {
+        poster.PostTask(
+            [&executed] { executed.fetch_add(1, std::memory_order_relaxed); });
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  while (executed.load(std::memory_order_relaxed) < total) {
+    std::this_thread::yield();
+  }
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  return total / elapsed.count();
+}
+
+void BenchmarkPostTask() {
+  const int32_t kProducers[] = {1, 4, 16};
+  printf("%-12s %-10s %16s\n", "path", "producers", "tasks/s");
+  for (int32_t producers : kProducers) {
+    {
+      LegacyPoster poster;
+      double rate = RunPostTask(poster, producers);
+      printf("%-12s %-10d %16.0f\n", "ioc_post", producers, rate);
+      Record("ioc_post/producers=" + std::to_string(producers), rate,
+             "tasks/s");
+    }
+    {
+      IOService io_service;
+      io_service.Start();
+      double rate = RunPostTask(io_service, producers);
+      io_service.Stop();
+      printf("%-12s %-10d %16.0f\n", "scheduler", producers, rate);
+      Record("scheduler/producers=" + std::to_string(producers), rate,
+             "tasks/s");
+    }
+    {
+      IOService io_service;
+      io_service.SetTaskQueueBackend(TASK_QUEUE_BACKEND_MPSC);
+      io_service.Start();
+      double rate = RunPostTask(io_service, producers);
+      io_service.Stop();
+      printf("%-12s %-10d %16.0f\n", "mpsc", producers, rate);
+      Record("mpsc/producers=" + std::to_string(producers), rate, "tasks/s");
+    }
+  }
+}
+
+// Heap allocations per PostTask at steady state, from an external producer
+// and from io thread itself. The external producer posts in batches, so the
+// queue depth stays bounded as it does in a steady state.
+void BenchmarkPostAllocations() {
+  const int32_t kBatch = 1000;
+  const int32_t kWarmupBatches = 10;
+  const int32_t kTasks = 1000000;
+  IOService io_service;
+  io_service.Start();
+
+  std::atomic<int32_t> executed(0);
+  auto post_batches = [&io_service, &executed](int32_t batches) {
+    for (int32_t i = 0; i < batches; ++i) {
+      int32_t target = executed.load() + kBatch;
+      for (int32_t j = 0; j < kBatch; ++j) {
+        io_service.PostTask(
+            [&executed] { executed.fetch_add(1, std::memory_order_relaxed); });
+      }
+      while (executed.load(std::memory_order_relaxed) < target) {
+        std::this_thread::yield();
+      }
+    }
+  };
+
+  post_batches(kWarmupBatches);
+  g_allocations = 0;
+  g_count_allocations = true;
+  post_batches(kTasks / kBatch);
+  g_count_allocations = false;
+  printf("%-12s %16.6f allocations/post\n", "external",
+         static_cast<double>(g_allocations) / kTasks);
+  Record("external", static_cast<double>(g_allocations) / kTasks,
+         "allocations/post");
+
+  // Tasks posted by io thread itself, chained one by one.
+  std::atomic<int32_t> remain(kTasks);
+  std::function<void()> chain;
+  chain = [&io_service, &remain, &chain] {
+    if (remain.fetch_sub(1) > 1) {
+      io_service.PostTask([&chain] { chain(); });
+    }
+  };
+  g_allocations = 0;
+  g_count_allocations = true;
+  io_service.PostTask([&chain] { chain(); });
+  while (remain.load() > 0) {
+    std::this_thread::yield();
+  }
+  g_count_allocations = false;
+  printf("%-12s %16.6f allocations/post\n", "io_thread",
+         static_cast<double>(g_allocations) / kTasks);
+  Record("io_thread", static_cast<double>(g_allocations) / kTasks,
+         "allocations/post");
+
+  io_service.Stop();
+}
+
+// Allocations and time per ExecuteFunction(), which takes UniqueFunction, vs
+// posting the same closure wrapped in std::function. The closure captures a
+// shared_ptr and a pointer, too big for the small buffer of std::function.
+void BenchmarkExecuteFunction() {
+  const int32_t kBatch = 1000;
+  const int32_t kWarmupBatches = 10;
+  const int32_t kTasks = 1000000;
+  IOService io_service;
+  io_service.Start();
+
+  std::shared_ptr<int32_t> payload = std::make_shared<int32_t>(1);
+  std::atomic<int32_t> executed(0);
+  auto run = [&io_service, &executed, &payload](const char* name,
+                                                bool unique, int32_t batches,
+                                                bool record) {
+    g_allocations = 0;
+    g_count_allocations = record;
+    Clock::time_point start = Clock::now();
+    for (int32_t i = 0; i < batches; ++i) {
+      int32_t target = executed.load() + kBatch;
+      for (int32_t j = 0; j < kBatch; ++j) {
+        auto closure = [payload, &executed] {
+          executed.fetch_add(*payload, std::memory_order_relaxed);
+        };
+        if (unique) {
+          io_service.ExecuteFunction(std::move(closure));
+        } else {
+          io_service.PostTask(std::function<void()>(std::move(closure)));
+        }
+      }
+      while (executed.load(std::memory_order_relaxed) < target) {
+        std::this_thread::yield();
+      }
+    }
+    g_count_allocations = false;
+    if (record) {
+      double tasks = static_cast<double>(batches) * kBatch;
+      double allocations = static_cast<double>(g_allocations) / tasks;
+      double ns = std::chrono::duration<double, std::nano>(Clock::now() -
+                                                           start)
+                      .count() /
+                  tasks;
+      printf("%-16s %12.6f allocations/post %10.1f ns/task\n", name,
+             allocations, ns);
+      Record(std::string(name) + ".allocations", allocations,
+             "allocations/post");
+      Record(std::string(name) + ".latency", ns, "ns/task");
+    }
+  };
+
+  run("unique_function", true, kWarmupBatches, false);
+  run("unique_function", true, kTasks / kBatch, true);
+  run("std_function", false, kWarmupBatches, false);
+  run("std_function", false, kTasks / kBatch, true);
+
+  io_service.Stop();
+}
+
+// Out of line callee, so the wrapper is really built and passed per call.
+template <class FunctionT>
+BENCHMARK_NOINLINE int64_t CallWrapper(FunctionT function) {
+  return function();
+}
+
+template <class FunctionT>
+void RunFunctionWrapper(const char* name) {
+  const int32_t kCalls = 10000000;
+  int64_t a = 1;
+  int64_t b = 2;
+  volatile int64_t sum = 0;
+  g_allocations = 0;
+  g_count_allocations = true;
+  Clock::time_point start = Clock::now();
+  for (int32_t i = 0; i < kCalls; ++i) {
+    // 24 bytes of captures, beyond the small buffer of std::function.
+    sum = sum + CallWrapper<FunctionT>([&a, &b, i] { return a + b + i; });
+  }
+  double ns =
+      std::chrono::duration<double, std::nano>(Clock::now() - start).count() /
+      kCalls;
+  g_count_allocations = false;
+  double allocations = static_cast<double>(g_allocations) / kCalls;
+  printf("%-16s %6zu %12.2f %12.2f\n", name, sizeof(FunctionT), ns,
+         allocations);
+  Record(std::string(name) + ".latency", ns, "ns/call");
+  Record(std::string(name) + ".allocations", allocations, "allocations/call");
+}
+
+// Cost of building a type erased wrapper from a closure and calling it once,
+// as PostTask, Invoke and timers do.
+void BenchmarkFunctionWrappers() {
+  printf("%-16s %6s %12s %12s\n", "wrapper", "bytes", "ns/call",
+         "allocs/call");
+  RunFunctionWrapper<FunctionView<int64_t()>>("function_view");
+  RunFunctionWrapper<InplaceFunction<int64_t()>>("inplace_function");
+  RunFunctionWrapper<UniqueFunction<int64_t()>>("unique_function");
+  RunFunctionWrapper<std::function<int64_t()>>("std_function");
+}
+
+// Round trip latency of Invoke from an external thread.
+void BenchmarkInvokeLatency() {
+  const int32_t kWarmupInvokes = 10000;
+  const int32_t kInvokes = 200000;
+  IOService io_service;
+  io_service.Start();
+
+  int32_t value = 0;
+  for (int32_t i = 0; i < kWarmupInvokes; ++i) {
+    io_service.Invoke<void>([&value] { ++value; });
+  }
+
+  std::vector<int64_t> latencies;
+  latencies.reserve(kInvokes);
+  g_allocations = 0;
+  g_count_allocations = true;
+  for (int32_t i = 0; i < kInvokes; ++i) {
+    Clock::time_point start = Clock::now();
+    io_service.Invoke<void>([&value] { ++value; });
+    latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            Clock::now() - start)
+                            .count());
+  }
+  g_count_allocations = false;
+  io_service.Stop();
+
+  std::sort(latencies.begin(), latencies.end());
+  printf("%-12s p50 %8lld ns  p99 %8lld ns  %.6f allocations/invoke\n",
+         "invoke", static_cast<long long>(Percentile(latencies, 50)),
+         static_cast<long long>(Percentile(latencies, 99)),
+         static_cast<double>(g_allocations) / kInvokes);
+  Record("p50", static_cast<double>(Percentile(latencies, 50)), "ns");
+  Record("p99", static_cast<double>(Percentile(latencies, 99)), "ns");
+  Record("allocations", static_cast<double>(g_allocations) / kInvokes,
+         "allocations/invoke");
+}
+
+// Fan out |batch_size| tasks at once, by PostTask one by one or PostTasks.
+void BenchmarkPostTasks() {
+  const int32_t kBatchSizes[] = {8, 32, 128};
+  const int32_t kTasks = 1600000;
+  printf("%-12s %-10s %16s\n", "path", "batch", "tasks/s");
+  for (int32_t batch_size : kBatchSizes) {
+    for (int32_t batched = 0; batched < 2; ++batched) {
+      IOService io_service;
+      io_service.Start();
+      std::atomic<int32_t> executed(0);
+      auto functor = [&executed] {
+        executed.fetch_add(1, std::memory_order_relaxed);
+      };
+      Clock::time_point start = Clock::now();
+      for (int32_t i = 0; i < kTasks / batch_size; ++i) {
+        if (batched) {
+          TaskBatch batch;
+          for (int32_t j = 0; j < batch_size; ++j) {
+            batch.Add(functor);
+          }
+          io_service.PostTasks(batch);
+        } else {
+          for (int32_t j = 0; j < batch_size; ++j) {
+            io_service.PostTask(functor);
+          }
+        }
+      }
+      int32_t total = kTasks / batch_size * batch_size;
+      while (executed.load(std::memory_order_relaxed) < total) {
+        std::this_thread::yield();
+      }
+      std::chrono::duration<double> elapsed = Clock::now() - start;
+      io_service.Stop();
+      printf("%-12s %-10d %16.0f\n", batched ? "PostTasks" : "PostTask",
+             batch_size, total / elapsed.count());
+      Record(std::string(batched ? "PostTasks" : "PostTask") +
+                 "/batch=" + std::to_string(batch_size),
+             total / elapsed.count(), "tasks/s");
+    }
+  }
+}
+
+// Latency of a task posted behind a flood of background tasks, by priority
+// of the probe task.
+void BenchmarkPriorityLatency() {
+  const TaskPriority kPriorities[] = {TASK_PRIORITY_HIGH, TASK_PRIORITY_NORMAL,
+                                      TASK_PRIORITY_BACKGROUND};
+  const char* kNames[] = {"high", "normal", "background"};
+  const int32_t kFlood = 100000;
+  const int32_t kProbes = 20;
+  printf("%-12s %-10s %16s\n", "priority", "backlog", "p50 latency us");
+  for (TaskPriority priority : kPriorities) {
+    IOService io_service;
+    io_service.Start();
+    std::vector<int64_t> latencies;
+    for (int32_t i = 0; i < kProbes; ++i) {
+      // Hold io thread until the backlog is queued.
+      std::atomic<bool> gate(false);
+      io_service.PostTask([&gate] {
+        while (!gate.load()) {
+          std::this_thread::yield();
+        }
+      });
+      volatile int32_t sink = 0;
+      for (int32_t j = 0; j < kFlood; ++j) {
+        io_service.PostTask([&sink] { sink = sink + 1; },
+                            TASK_PRIORITY_BACKGROUND);
+      }
+      std::atomic<bool> done(false);
+      io_service.PostTask([&done] { done = true; }, priority);
+      Clock::time_point start = Clock::now();
+      gate = true;
+      while (!done.load()) {
+        std::this_thread::yield();
+      }
+      latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+                              Clock::now() - start)
+                              .count());
+      // Let the flood go before the next probe.
+      while (io_service.QueueDepth(TASK_PRIORITY_BACKGROUND) > 0) {
+        std::this_thread::yield();
+      }
+      io_service.Invoke<void>([] {});
+    }
+    io_service.Stop();
+    std::sort(latencies.begin(), latencies.end());
+    printf("%-12s %-10d %16lld\n", kNames[priority], kFlood,
+           static_cast<long long>(Percentile(latencies, 50)));
+    Record(std::string(kNames[priority]) + "/p50",
+           static_cast<double>(Percentile(latencies, 50)), "us");
+  }
+}
+
+void PrintTimeouts(const char* path,
+                   int32_t timeouts,
+                   Clock::time_point start,
+                   Clock::time_point middle,
+                   Clock::time_point end) {
+  double arm =
+      std::chrono::duration<double, std::nano>(middle - start).count() /
+      timeouts;
+  double cancel =
+      std::chrono::duration<double, std::nano>(end - middle).count() /
+      timeouts;
+  printf("%-12s %-10d %16.1f %16.1f\n", path, timeouts, arm, cancel);
+  Record(std::string(path) + "/arm", arm, "ns/op");
+  Record(std::string(path) + "/cancel", cancel, "ns/op");
+}
+
+// Cost of arming and cancelling request timeouts, by Timer objects or by
+// cancellable delayed tasks.
+void BenchmarkTimeouts() {
+  const int32_t kTimeouts = 100000;
+  const int32_t kDelay = 60000;
+  printf("%-12s %-10s %16s %16s\n", "path", "timeouts", "arm ns/op",
+         "cancel ns/op");
+  std::shared_ptr<IOService> io_service = std::make_shared<IOService>();
+  io_service->Start();
+  {
+    std::vector<std::shared_ptr<Timer>> timers;
+    timers.reserve(kTimeouts);
+    Clock::time_point start = Clock::now();
+    for (int32_t i = 0; i < kTimeouts; ++i) {
+      std::shared_ptr<Timer> timer = io_service->CreateTimer();
+      timer->Open(kDelay, false, [] {});
+      timers.push_back(timer);
+    }
+    Clock::time_point middle = Clock::now();
+    for (auto& timer : timers) {
+      timer->Close();
+    }
+    Clock::time_point end = Clock::now();
+    PrintTimeouts("Timer", kTimeouts, start, middle, end);
+    // Let the cancelled waits complete before the timers are deleted.
+    io_service->Invoke<void>([] {});
+  }
+  {
+    std::vector<TaskHandle> handles;
+    handles.reserve(kTimeouts);
+    Clock::time_point start = Clock::now();
+    for (int32_t i = 0; i < kTimeouts; ++i) {
+      handles.push_back(io_service->PostCancelableDelayedTask([] {}, kDelay));
+    }
+    Clock::time_point middle = Clock::now();
+    for (auto& handle : handles) {
+      handle.Cancel();
+    }
+    Clock::time_point end = Clock::now();
+    PrintTimeouts("DelayedTask", kTimeouts, start, middle, end);
+  }
+  {
+    // Hold the loop so that tasks are still queued when cancelled.
+    Completion gate;
+    io_service->PostTask([&gate] { gate.Wait(); });
+    std::vector<TaskHandle> handles;
+    handles.reserve(kTimeouts);
+    Clock::time_point start = Clock::now();
+    for (int32_t i = 0; i < kTimeouts; ++i) {
+      handles.push_back(io_service->PostCancelableTask([] {}));
+    }
+    Clock::time_point middle = Clock::now();
+    for (auto& handle : handles) {
+      handle.Cancel();
+    }
+    Clock::time_point end = Clock::now();
+    gate.Notify();
+    PrintTimeouts("Task", kTimeouts, start, middle, end);
+    io_service->Invoke<void>([] {});
+  }
+  io_service->Stop();
+}
+
+// PostTask throughput without task statistics, with every task recorded and
+// with the default sampling.
+void BenchmarkStatsOverhead() {
+  printf("%-12s %-10s %16s\n", "stats", "producers", "tasks/s");
+  const char* names[] = {"off", "on", "sampled"};
+  const int32_t intervals[] = {0, 1, 16};
+  for (int32_t i = 0; i < 3; ++i) {
+    IOService io_service;
+    io_service.SetStatsEnabled(intervals[i] > 0);
+    io_service.SetStatsSampleInterval(intervals[i]);
+    io_service.Start();
+    double rate = RunPostTask(io_service, 1);
+    IOServiceStats stats = io_service.GetStats();
+    io_service.Stop();
+    std::string name = names[i];
+    printf("%-12s %-10d %16.0f", name.c_str(), 1, rate);
+    Record(name, rate, "tasks/s");
+    if (intervals[i] > 0) {
+      Record(name + "/latency_p50",
+             static_cast<double>(stats.queue_latency.p50), "ns");
+      Record(name + "/latency_p99",
+             static_cast<double>(stats.queue_latency.p99), "ns");
+      printf("  latency p50 %llu ns p99 %llu ns, run p50 %llu ns",
+             static_cast<unsigned long long>(stats.queue_latency.p50),
+             static_cast<unsigned long long>(stats.queue_latency.p99),
+             static_cast<unsigned long long>(stats.run_time.p50));
+    }
+    printf("\n");
+  }
+}
+
+void BenchmarkWatchdogOverhead() {
+  printf("%-12s %-10s %16s\n", "watchdog", "producers", "tasks/s");
+  for (int32_t enabled = 0; enabled < 2; ++enabled) {
+    IOService io_service;
+    io_service.SetSlowTaskThreshold(enabled ? 100 : 0);
+    io_service.Start();
+    double rate = RunPostTask(io_service, 1);
+    io_service.Stop();
+    printf("%-12s %-10d %16.0f\n", enabled ? "on" : "off", 1, rate);
+    Record(enabled ? "on" : "off", rate, "tasks/s");
+  }
+}
+
+// Flood an io thread with tasks slower than the producer, unbounded by
+// PostTask() and bounded by TryPostTask(), report refused tasks, peak queue
+// depth and watermark events. Then the cost of counting tasks at full speed.
+void BenchmarkBoundedQueue() {
+  const int32_t kTasks = 200000;
+  const size_t kMaxTasks = 10000;
+  printf("%-12s %12s %12s %12s %12s\n", "queue", "posted", "refused",
+         "peak depth", "watermarks");
+  for (int32_t bounded = 0; bounded < 2; ++bounded) {
+    std::atomic<int32_t> watermarks(0);
+    IOService io_service;
+    if (bounded) {
+      TaskQueueLimits limits;
+      limits.max_tasks = kMaxTasks;
+      limits.high_watermark = kMaxTasks * 8 / 10;
+      limits.low_watermark = kMaxTasks * 2 / 10;
+      limits.watermark_callback = [&watermarks](bool) {
+        watermarks.fetch_add(1, std::memory_order_relaxed);
+      };
+      io_service.SetQueueLimits(limits);
+    }
+    io_service.Start();
+    std::atomic<int32_t> executed(0);
+    auto task = [&executed] {
+      volatile int32_t work = 0;
+      for (int32_t i = 0; i < 200; ++i) {
+        work = work + i;
+      }
+      executed.fetch_add(1, std::memory_order_relaxed);
+    };
+    int32_t posted = 0;
+    int32_t refused = 0;
+    int32_t peak = 0;
+    for (int32_t i = 0; i < kTasks; ++i) {
+      if (!bounded) {
+        io_service.PostTask(task);
+      } else if (!io_service.TryPostTask(task)) {
+        ++refused;
+        continue;
+      }
+      ++posted;
+      peak = (std::max)(peak,
+                        posted - executed.load(std::memory_order_relaxed));
+    }
+    while (executed.load(std::memory_order_relaxed) < posted) {
+      std::this_thread::yield();
+    }
+    io_service.Stop();
+    const char* name = bounded ? "bounded" : "unbounded";
+    printf("%-12s %12d %12d %12d %12d\n", name, posted, refused, peak,
+           watermarks.load());
+    Record(std::string(name) + "/refused", refused, "tasks");
+    Record(std::string(name) + "/peak_depth", peak, "tasks");
+  }
+
+  printf("%-12s %-10s %16s\n", "limits", "producers", "tasks/s");
+  for (int32_t enabled = 0; enabled < 2; ++enabled) {
+    IOService io_service;
+    if (enabled) {
+      TaskQueueLimits limits;
+      limits.high_watermark = kTotalTasks;
+      io_service.SetQueueLimits(limits);
+    }
+    io_service.Start();
+    double rate = RunPostTask(io_service, 1);
+    io_service.Stop();
+    printf("%-12s %-10d %16.0f\n", enabled ? "on" : "off", 1, rate);
+    Record(enabled ? "on" : "off", rate, "tasks/s");
+  }
+}
+
+#if defined(BEE_ENABLE_TRACE)
+// PostTask throughput with tracing compiled in, idle and recording, and the
+// time to dump the recorded trace.
+void BenchmarkTraceOverhead() {
+  printf("%-12s %-10s %16s\n", "trace", "producers", "tasks/s");
+  for (int32_t recording = 0; recording < 2; ++recording) {
+    IOService io_service;
+    io_service.Start();
+    if (recording) {
+      TraceLog::Start();
+    }
+    double rate = RunPostTask(io_service, 1);
+    TraceLog::Stop();
+    io_service.Stop();
+    printf("%-12s %-10d %16.0f\n", recording ? "recording" : "idle", 1, rate);
+    Record(recording ? "recording" : "idle", rate, "tasks/s");
+  }
+
+  Clock::time_point start = Clock::now();
+  bool written = TraceLog::WriteChromeTrace("trace_overhead.json");
+  std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+  printf("dump %s in %.1f ms\n", written ? "written" : "failed",
+         elapsed.count());
+  Record("dump", elapsed.count(), "ms");
+}
+#endif
+
+// Post kTotalTasks tasks round robin to |posters| from one thread, return
+// tasks per second.
+template <class PosterT>
+double RunPostTaskRoundRobin(std::vector<PosterT*>& posters) {
+  std::atomic<int32_t> executed(0);
+  int32_t total = kTotalTasks;
+
+  Clock::time_point start = Clock::now();
+  for (int32_t i = 0; i < total; ++i) {
+    posters[i % posters.size()]->PostTask(
+        [&executed] { executed.fetch_add(1, std::memory_order_relaxed); });
+  }
+  while (executed.load(std::memory_order_relaxed) < total) {
+    std::this_thread::yield();
+  }
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  return total / elapsed.count();
+}
+
+// Ordered components with a thread each, against sequenced task runners on a
+// pool of 2 threads.
+void BenchmarkSequencedTaskRunner() {
+  const int32_t kComponents[] = {4, 64};
+  printf("%-12s %-10s %16s\n", "ordering", "components", "tasks/s");
+  for (int32_t components : kComponents) {
+    {
+      std::vector<std::unique_ptr<IOService>> io_services;
+      std::vector<IOService*> posters;
+      for (int32_t i = 0; i < components; ++i) {
+        io_services.emplace_back(new IOService);
+        io_services.back()->Start();
+        posters.push_back(io_services.back().get());
+      }
+      double rate = RunPostTaskRoundRobin(posters);
+      for (auto& io_service : io_services) {
+        io_service->Stop();
+      }
+      printf("%-12s %-10d %16.0f\n", "io_service", components, rate);
+      Record("io_service/components=" + std::to_string(components), rate,
+             "tasks/s");
+    }
+    {
+      IOService io_service;
+      io_service.Start(2);
+      std::vector<std::shared_ptr<SequencedTaskRunner>> runners;
+      std::vector<SequencedTaskRunner*> posters;
+      for (int32_t i = 0; i < components; ++i) {
+        runners.push_back(SequencedTaskRunner::Create(&io_service));
+        posters.push_back(runners.back().get());
+      }
+      double rate = RunPostTaskRoundRobin(posters);
+      runners.clear();
+      io_service.Stop();
+      printf("%-12s %-10d %16.0f\n", "sequenced", components, rate);
+      Record("sequenced/components=" + std::to_string(components), rate,
+             "tasks/s");
+    }
+  }
+}
+
+// Post |tasks| tasks round robin to |keys| of |group| from one thread, each
+// spinning |work| iterations, return tasks per second. With |ticks|, wait
+// for each round of one task per key to finish, like per tick work.
+double RunPostTaskKeyed(IOServiceGroup& group,
+                        const std::vector<uint64_t>& keys,
+                        int32_t tasks,
+                        int32_t work,
+                        bool ticks) {
+  std::atomic<int32_t> executed(0);
+  Clock::time_point start = Clock::now();
+  for (int32_t i = 0; i < tasks; ++i) {
+    if (ticks && i % keys.size() == 0) {
+      while (executed.load(std::memory_order_relaxed) < i) {
+        std::this_thread::yield();
+      }
+    }
+    group.PostTask(keys[i % keys.size()], [&executed, work] {
+      volatile int32_t sum = 0;
+      for (int32_t j = 0; j < work; ++j) {
+        sum = sum + j;
+      }
+      executed.fetch_add(1, std::memory_order_relaxed);
+    });
+  }
+  while (executed.load(std::memory_order_relaxed) < tasks) {
+    std::this_thread::yield();
+  }
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  return tasks / elapsed.count();
+}
+
+// Keyed tasks on a group of shards with fixed and rebalanced key mapping.
+// First a flood of spread keys, then ticks of skewed keys which all hash to
+// shard 0, where rebalancing moves keys to idle shards between ticks.
+void BenchmarkServiceGroup() {
+  const int32_t kShards = 4;
+  const int32_t kKeys = 64;
+  const int32_t kSkewedTasks = 200000;
+  printf("%-12s %-10s %16s %16s\n", "mapping", "keys", "tasks/s", "moved");
+  for (int32_t skewed = 0; skewed < 2; ++skewed) {
+    for (int32_t rebalance = 0; rebalance < 2; ++rebalance) {
+      IOServiceGroup group(kShards);
+      if (rebalance) {
+        ShardRebalancePolicy policy;
+        policy.interval = 10;
+        policy.persistence = 2;
+        group.SetRebalancePolicy(policy);
+      }
+      group.Start();
+      std::vector<uint64_t> keys;
+      for (uint64_t key = 0; static_cast<int32_t>(keys.size()) < kKeys;
+           ++key) {
+        if (!skewed || group.ShardOf(key) == group.Shard(0)) {
+          keys.push_back(key);
+        }
+      }
+      double rate =
+          skewed ? RunPostTaskKeyed(group, keys, kSkewedTasks, 2000, true)
+                 : RunPostTaskKeyed(group, keys, kTotalTasks, 0, false);
+      int64_t moved = group.MovedBuckets();
+      group.Stop();
+      std::string name = std::string(rebalance ? "rebalanced" : "fixed") +
+                         (skewed ? "/skewed" : "/spread");
+      printf("%-12s %-10s %16.0f %16lld\n", rebalance ? "rebalanced" : "fixed",
+             skewed ? "skewed" : "spread", rate,
+             static_cast<long long>(moved));
+      Record(name, rate, "tasks/s");
+    }
+  }
+}
+
+// Checksum of [begin, end) of |data|, FNV-1a over 32 bit words.
+uint32_t Checksum(const uint32_t* data, size_t begin, size_t end) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = begin; i < end; ++i) {
+    hash = (hash ^ data[i]) * 16777619u;
+  }
+  return hash;
+}
+
+// ParallelReduce checksum of a 64 MB buffer and ParallelFor fan out to 4096
+// peers, run from a pool thread of 1 to N threads, so the pool uses exactly
+// that many cores. Speedup is against 1 thread, which runs chunks serially.
+void BenchmarkParallelFor() {
+  const size_t kWords = 16 * 1024 * 1024;
+  const size_t kPeers = 4096;
+  const int32_t kRuns = 5;
+  std::vector<uint32_t> data(kWords);
+  for (size_t i = 0; i < kWords; ++i) {
+    data[i] = static_cast<uint32_t>(i * 2654435761u);
+  }
+  std::vector<uint32_t> peers(kPeers);
+
+  int32_t max_threads =
+      (std::max)(1, static_cast<int32_t>(std::thread::hardware_concurrency()));
+  std::vector<int32_t> thread_counts;
+  for (int32_t threads = 1; threads < max_threads; threads *= 2) {
+    thread_counts.push_back(threads);
+  }
+  thread_counts.push_back(max_threads);
+
+  printf("%-12s %-10s %16s %16s\n", "work", "threads", "ms/run", "speedup");
+  double serial[2] = {0, 0};
+  for (int32_t threads : thread_counts) {
+    IOService io_service;
+    io_service.Start(threads);
+    double elapsed[2] = {0, 0};
+    io_service.Invoke<void>([&] {
+      for (int32_t run = 0; run < kRuns; ++run) {
+        Clock::time_point start = Clock::now();
+        volatile uint32_t checksum = ParallelReduce(
+            &io_service, 0, kWords, 64 * 1024, 0u,
+            [&data](size_t begin, size_t end) {
+              return Checksum(data.data(), begin, end);
+            },
+            [](uint32_t a, uint32_t b) { return a ^ b; });
+        (void)checksum;
+        Clock::time_point middle = Clock::now();
+        ParallelFor(&io_service, 0, kPeers, 64,
+                    [&data, &peers](size_t begin, size_t end) {
+                      for (size_t i = begin; i < end; ++i) {
+                        // Encode a 4 KB message for each peer.
+                        peers[i] = Checksum(data.data(), i * 1024,
+                                            i * 1024 + 1024);
+                      }
+                    });
+        Clock::time_point end = Clock::now();
+        elapsed[0] += std::chrono::duration<double, std::milli>(middle - start)
+                          .count();
+        elapsed[1] +=
+            std::chrono::duration<double, std::milli>(end - middle).count();
+      }
+    });
+    io_service.Stop();
+
+    const char* kNames[] = {"checksum", "fan_out"};
+    for (int32_t i = 0; i < 2; ++i) {
+      double ms = elapsed[i] / kRuns;
+      if (threads == 1) {
+        serial[i] = ms;
+      }
+      printf("%-12s %-10d %16.2f %16.2f\n", kNames[i], threads, ms,
+             serial[i] / ms);
+      Record(std::string(kNames[i]) + "/threads=" + std::to_string(threads),
+             ms, "ms/run");
+    }
+  }
+}
+
+// Post a task every 100 us to an idle io_context, with blocking run() and
+// with busy poll, and compare the wakeup latency.
+void BenchmarkBusyPoll() {
+  const int32_t kDurations[] = {0, 1000};
+  const int32_t kRounds = 2000;
+  printf("%-12s %16s %16s %16s\n", "busy_poll_us", "wakeup p50 ns",
+         "wakeup p99 ns", "latency p50 ns");
+  for (int32_t duration : kDurations) {
+    IOService io_service;
+    io_service.SetStatsEnabled(true);
+    io_service.SetBusyPollDuration(duration);
+    io_service.Start();
+    std::atomic<int32_t> executed(0);
+    for (int32_t i = 0; i < kRounds; ++i) {
+      io_service.PostTask(
+          [&executed] { executed.fetch_add(1, std::memory_order_release); });
+      while (executed.load(std::memory_order_acquire) <= i) {
+        std::this_thread::yield();
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    IOServiceStats stats = io_service.GetStats();
+    io_service.Stop();
+    printf("%-12d %16llu %16llu %16llu\n", duration,
+           static_cast<unsigned long long>(stats.wakeup_latency.p50),
+           static_cast<unsigned long long>(stats.wakeup_latency.p99),
+           static_cast<unsigned long long>(stats.queue_latency.p50));
+    std::string name = "busy_poll_us=" + std::to_string(duration);
+    Record(name + "/wakeup_p50", static_cast<double>(stats.wakeup_latency.p50),
+           "ns");
+    Record(name + "/wakeup_p99", static_cast<double>(stats.wakeup_latency.p99),
+           "ns");
+  }
+}
+
+// Session setup cost, an IOService started, invoked and stopped per session,
+// with threads created per session and adopted from ThreadCache.
+void BenchmarkSessionSetup() {
+  const int32_t kSessions = 1000;
+  const size_t kCapacities[] = {0, 16};
+  printf("%-12s %-10s %16s\n", "thread_cache", "sessions", "us/session");
+  for (size_t capacity : kCapacities) {
+    ThreadCache::SetCapacity(capacity);
+    Clock::time_point start = Clock::now();
+    for (int32_t i = 0; i < kSessions; ++i) {
+      IOService io_service;
+      io_service.Start();
+      io_service.Invoke<void>([] {});
+      io_service.Stop();
+    }
+    std::chrono::duration<double, std::micro> elapsed = Clock::now() - start;
+    printf("%-12zu %-10d %16.1f\n", capacity, kSessions,
+           elapsed.count() / kSessions);
+    Record("thread_cache=" + std::to_string(capacity),
+           elapsed.count() / kSessions, "us/session");
+  }
+}
+
+// Lateness of timers firing, by Timer objects and by delayed tasks, with
+// delays spread over 1..kMaxDelay milliseconds.
+void BenchmarkTimerAccuracy() {
+  const int32_t kTimers = 500;
+  const int32_t kMaxDelay = 50;
+  IOService io_service;
+  io_service.Start();
+  printf("%-12s %-10s %16s %16s %16s\n", "path", "timers", "p50 late us",
+         "p99 late us", "max late us");
+  for (int32_t path = 0; path < 2; ++path) {
+    std::vector<int64_t> lateness(kTimers);
+    std::atomic<int32_t> fired(0);
+    std::vector<std::shared_ptr<Timer>> timers;
+    Clock::time_point start = Clock::now();
+    for (int32_t i = 0; i < kTimers; ++i) {
+      int32_t delay = i % kMaxDelay + 1;
+      Clock::time_point deadline = start + std::chrono::milliseconds(delay);
+      auto callback = [&lateness, &fired, i, deadline] {
+        lateness[i] = std::chrono::duration_cast<std::chrono::microseconds>(
+                          Clock::now() - deadline)
+                          .count();
+        fired.fetch_add(1, std::memory_order_release);
+      };
+      if (path == 0) {
+        std::shared_ptr<Timer> timer = io_service.CreateTimer();
+        timer->Open(delay, false, callback);
+        timers.push_back(timer);
+      } else {
+        io_service.PostDelayedTask(callback, delay);
+      }
+    }
+    while (fired.load(std::memory_order_acquire) < kTimers) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    for (auto& timer : timers) {
+      timer->Close();
+    }
+    io_service.Invoke<void>([] {});
+
+    const char* name = (path == 0) ? "Timer" : "DelayedTask";
+    std::sort(lateness.begin(), lateness.end());
+    printf("%-12s %-10d %16lld %16lld %16lld\n", name, kTimers,
+           static_cast<long long>(Percentile(lateness, 50)),
+           static_cast<long long>(Percentile(lateness, 99)),
+           static_cast<long long>(lateness.back()));
+    Record(std::string(name) + "/late_p50",
+           static_cast<double>(Percentile(lateness, 50)), "us");
+    Record(std::string(name) + "/late_p99",
+           static_cast<double>(Percentile(lateness, 99)), "us");
+    Record(std::string(name) + "/late_max",
+           static_cast<double>(lateness.back()), "us");
+  }
+  io_service.Stop();
+}
+
+// Cost of creating and deleting Timer and WebSocket objects.
+void BenchmarkCreateObjects() {
+  const int32_t kObjects = 10000;
+  IOService io_service;
+  io_service.Start();
+  printf("%-12s %-10s %16s %16s\n", "object", "count", "create ns/op",
+         "delete ns/op");
+  for (int32_t type = 0; type < 2; ++type) {
+    const char* name = (type == 0) ? "Timer" : "WebSocket";
+    std::vector<std::shared_ptr<void>> objects;
+    objects.reserve(kObjects);
+    Clock::time_point start = Clock::now();
+    for (int32_t i = 0; i < kObjects; ++i) {
+      if (type == 0) {
+        objects.push_back(io_service.CreateTimer());
+      } else {
+        objects.push_back(io_service.CreateWebSocket());
+      }
+    }
+    Clock::time_point middle = Clock::now();
+    objects.clear();
+    Clock::time_point end = Clock::now();
+    double create =
+        std::chrono::duration<double, std::nano>(middle - start).count() /
+        kObjects;
+    double destroy =
+        std::chrono::duration<double, std::nano>(end - middle).count() /
+        kObjects;
+    printf("%-12s %-10d %16.1f %16.1f\n", name, kObjects, create, destroy);
+    Record(std::string(name) + "/create", create, "ns/op");
+    Record(std::string(name) + "/delete", destroy, "ns/op");
+  }
+  io_service.Stop();
+}
+
+// Websocket echo server on loopback, running on its own io_context thread.
+class EchoServer {
+ public:
+  typedef boost::asio::ip::tcp tcp;
+
+  EchoServer()
+      : acceptor_(ioc_,
+                  tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)) {
+    Accept();
+    thread_ = std::thread([this] { ioc_.run(); });
+  }
+
+  ~EchoServer() {
+    ioc_.stop();
+    thread_.join();
+  }
+
+  uint16_t Port() const { return acceptor_.local_endpoint().port(); }
+
+ private:
+  class Session : public std::enable_shared_from_this<Session> {
+   public:
+    explicit Session(tcp::socket socket) : ws_(std::move(socket)) {}
+
+    void Start() {
+      std::shared_ptr<Session> self = shared_from_this();
+      ws_.async_accept([self](const boost::system::error_code& ec) {
+        if (!ec) {
+          self->Read();
+        }
+      });
+    }
+
+   private:
+    void Read() {
+      std::shared_ptr<Session> self = shared_from_this();
+      ws_.async_read(buffer_, [self](const boost::system::error_code& ec,
+                                     size_t) {
+        if (!ec) {
+          self->Echo();
+        }
+      });
+    }
+
+    void Echo() {
+      std::shared_ptr<Session> self = shared_from_this();
+      ws_.text(ws_.got_text());
+      ws_.async_write(buffer_.data(), [self](const boost::system::error_code& ec,
+                                             size_t) {
+        if (!ec) {
+          self->buffer_.consume(self->buffer_.size());
+          self->Read();
+        }
+      });
+    }
+
+    boost::beast::websocket::stream<tcp::socket> ws_;
+    boost::beast::flat_buffer buffer_;
+  };
+
+  void Accept() {
+    acceptor_.async_accept(
+        [this](const boost::system::error_code& ec, tcp::socket socket) {
+          if (ec) {
+            return;
+          }
+          std::make_shared<Session>(std::move(socket))->Start();
+          Accept();
+        });
+  }
+
+  boost::asio::io_context ioc_;
+  tcp::acceptor acceptor_;
+  std::thread thread_;
+};
+
+// Client of EchoServer, sends the next message when the echo of the last one
+// comes back, until |round_trips| messages are echoed.
+class EchoClient : public WebSocketSink {
+ public:
+  EchoClient(WebSocket* websocket,
+             int32_t round_trips,
+             std::atomic<int32_t>* opened,
+             std::atomic<int32_t>* finished,
+             std::atomic<int32_t>* failed)
+      : websocket_(websocket),
+        round_trips_(round_trips),
+        received_(0),
+        opened_(opened),
+        finished_(finished),
+        failed_(failed) {}
+
+  // Send a message, call on io_context thread.
+  void Ping() { websocket_->Send(kMessage, sizeof(kMessage)); }
+
+  void OnOpen() override { opened_->fetch_add(1); }
+
+  void OnData(const char* buffer, size_t size) override {
+    if (++received_ < round_trips_) {
+      Ping();
+    } else {
+      finished_->fetch_add(1);
+    }
+  }
+
+  void OnClose() override {}
+
+  void OnError(int32_t error_code, const std::string& error_message) override {
+    printf("WebSocket error %d %s\n", error_code, error_message.c_str());
+    failed_->fetch_add(1);
+  }
+
+ private:
+  static const char kMessage[64];
+
+  WebSocket* websocket_;
+  const int32_t round_trips_;
+  int32_t received_;
+  std::atomic<int32_t>* opened_;
+  std::atomic<int32_t>* finished_;
+  std::atomic<int32_t>* failed_;
+};
+
+const char EchoClient::kMessage[64] = "ping";
+
+// Many websockets of one IOService talking to an echo server on loopback, a
+// message in flight per socket. Build with and without BEE_ENABLE_IO_URING
+// to compare epoll and io_uring, results are named by the backend. Heap
+// allocations are counted on both sides, the server uses default asio
+// handler allocation.
+void BenchmarkWebSocketLoopback() {
+  const int32_t kSocketCounts[] = {16, 256};
+  const int32_t kRoundTrips = 200;
+  EchoServer server;
+  std::string url = "ws://127.0.0.1:" + std::to_string(server.Port()) + "/";
+  const char* backend = IOService::IoBackend();
+  printf("%-10s %-10s %16s %16s %16s\n", "backend", "sockets", "us/open",
+         "round_trips/s", "allocs/trip");
+  for (int32_t count : kSocketCounts) {
+    IOService io_service;
+    io_service.Start();
+    std::vector<std::shared_ptr<WebSocket>> websockets;
+    std::vector<std::shared_ptr<EchoClient>> clients;
+    std::atomic<int32_t> opened(0);
+    std::atomic<int32_t> finished(0);
+    std::atomic<int32_t> failed(0);
+
+    Clock::time_point start = Clock::now();
+    io_service.Invoke<void>([&] {
+      for (int32_t i = 0; i < count; ++i) {
+        std::shared_ptr<WebSocket> websocket = io_service.CreateWebSocket();
+        std::shared_ptr<EchoClient> client = std::make_shared<EchoClient>(
+            websocket.get(), kRoundTrips, &opened, &finished, &failed);
+        websocket->Open(url, std::vector<std::string>(), client);
+        websockets.push_back(websocket);
+        clients.push_back(client);
+      }
+    });
+    while (opened.load() + failed.load() < count) {
+      std::this_thread::yield();
+    }
+    Clock::time_point middle = Clock::now();
+    g_allocations = 0;
+    g_count_allocations = true;
+    io_service.Invoke<void>([&] {
+      for (auto& client : clients) {
+        client->Ping();
+      }
+    });
+    while (finished.load() + failed.load() < count) {
+      std::this_thread::yield();
+    }
+    Clock::time_point end = Clock::now();
+    g_count_allocations = false;
+
+    double open =
+        std::chrono::duration<double, std::micro>(middle - start).count() /
+        count;
+    double rate = static_cast<double>(count) * kRoundTrips /
+                  std::chrono::duration<double>(end - middle).count();
+    double allocations =
+        static_cast<double>(g_allocations) / count / kRoundTrips;
+    printf("%-10s %-10d %16.1f %16.0f %16.2f\n", backend, count, open, rate,
+           allocations);
+    std::string name =
+        std::string(backend) + "/sockets=" + std::to_string(count);
+    Record(name + "/open", open, "us/socket");
+    Record(name + "/round_trips", rate, "round_trips/s");
+    Record(name + "/allocations", allocations, "allocations/round_trip");
+    if (failed.load() > 0) {
+      printf("%d websockets failed\n", failed.load());
+    }
+
+    // Close() waits for the io_context thread, so call it from here.
+    for (auto& websocket : websockets) {
+      websocket->Close();
+    }
+    io_service.Stop();
+  }
+}
+
+#if defined(BEE_HAS_COROUTINE)
+CoTask<int32_t> CoAdd(IOService* io_service, int32_t value) {
+  co_await io_service->Schedule();
+  co_return value + 1;
+}
+
+CoTask<void> CoLoop(IOService* io_service,
+                    int32_t count,
+                    std::atomic<bool>* done) {
+  int32_t value = 0;
+  for (int32_t i = 0; i < count; ++i) {
+    value = co_await CoAdd(io_service, value);
+  }
+  *done = true;
+}
+
+// Cost of awaiting a child coroutine which hops to io_context thread, the
+// frames come from TaskNodePool.
+void BenchmarkCoroutine() {
+  const int32_t kWarmup = 10000;
+  const int32_t kAwaits = 500000;
+  IOService io_service;
+  io_service.Start();
+  std::atomic<bool> done(false);
+  CoSpawn(CoLoop(&io_service, kWarmup, &done));
+  while (!done.load()) {
+    std::this_thread::yield();
+  }
+
+  done = false;
+  g_allocations = 0;
+  g_count_allocations = true;
+  Clock::time_point start = Clock::now();
+  CoSpawn(CoLoop(&io_service, kAwaits, &done));
+  while (!done.load()) {
+    std::this_thread::yield();
+  }
+  std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+  g_count_allocations = false;
+  io_service.Stop();
+  printf("%-12s %16.1f ns/await %16.6f allocations/await\n", "coroutine",
+         elapsed.count() / kAwaits,
+         static_cast<double>(g_allocations) / kAwaits);
+  Record("await", elapsed.count() / kAwaits, "ns/await");
+  Record("allocations", static_cast<double>(g_allocations) / kAwaits,
+         "allocations/await");
+}
+#endif
+
+struct Benchmark {
+  const char* name;
+  void (*function)();
+};
+
+const Benchmark kBenchmarks[] = {
+    {"post_task", BenchmarkPostTask},
+    {"post_allocations", BenchmarkPostAllocations},
+    {"execute_function", BenchmarkExecuteFunction},
+    {"function_wrappers", BenchmarkFunctionWrappers},
+    {"invoke_latency", BenchmarkInvokeLatency},
+    {"post_tasks", BenchmarkPostTasks},
+    {"priority_latency", BenchmarkPriorityLatency},
+    {"timeouts", BenchmarkTimeouts},
+    {"timer_accuracy", BenchmarkTimerAccuracy},
+    {"create_objects", BenchmarkCreateObjects},
+    {"stats_overhead", BenchmarkStatsOverhead},
+    {"watchdog_overhead", BenchmarkWatchdogOverhead},
+    {"bounded_queue", BenchmarkBoundedQueue},
+#if defined(BEE_ENABLE_TRACE)
+    {"trace_overhead", BenchmarkTraceOverhead},
+#endif
+    {"sequenced_task_runner", BenchmarkSequencedTaskRunner},
+    {"service_group", BenchmarkServiceGroup},
+    {"parallel_for", BenchmarkParallelFor},
+    {"busy_poll", BenchmarkBusyPoll},
+    {"session_setup", BenchmarkSessionSetup},
+    {"websocket_loopback", BenchmarkWebSocketLoopback},
+#if defined(BEE_HAS_COROUTINE)
+    {"coroutine", BenchmarkCoroutine},
+#endif
+};
+
+}  // namespace
+
+// Usage: benchAsync [--filter=<substring>] [--json=<path>]
+// Run benchmarks whose names contain the filter, all by default, and write
+// the results to |path| as JSON if given.
+int main(int argc, char* argv[]) {
+  const char* filter = "";
+  const char* json_path = nullptr;
+  for (int32_t i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "--filter=", 9) == 0) {
+      filter = argv[i] + 9;
+    } else if (strncmp(argv[i], "--json=", 7) == 0) {
+      json_path = argv[i] + 7;
+    } else {
+      printf("Usage: %s [--filter=<substring>] [--json=<path>]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  for (const Benchmark& benchmark : kBenchmarks) {
+    if (strstr(benchmark.name, filter) == nullptr) {
+      continue;
+    }
+    printf("[%s]\n", benchmark.name);
+    g_benchmark = benchmark.name;
+    benchmark.function();
+    printf("\n");
+  }
+
+  if (json_path != nullptr && !WriteJson(json_path)) {
+    printf("Write %s failed\n", json_path);
+    return 1;
+  }
+  return 0;
+}
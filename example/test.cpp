@@ -4,7 +4,7 @@
 #include <sstream>
 #include <string>
 
-#include "executor.h"
+#include "io_service.h"
 
 #ifdef LEAK_CHECK
 #ifdef WIN32
@@ -12,9 +12,9 @@
 #endif
 #endif
 
-using namespace qrtc;
+using namespace bee;
 
-Executor executor;
+IOService executor;
 
 long GetTid() {
   std::ostringstream oss;
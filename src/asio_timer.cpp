@@ -1,4 +1,6 @@
 ﻿#include "asio_timer.h"
+#include "task_node_pool.h"
+#include "trace.h"
 
 namespace bee {
 
@@ -15,11 +17,11 @@ void AsioTimer::Open(int32_t timeout, bool repeat, TimerCallback callback) {
   if (!is_closed_ && timeout > 0) {
     timeout_ = timeout;
     repeat_ = repeat;
-    timer_callback_ = callback;
+    timer_callback_ = std::move(callback);
 
     steady_timer_.expires_from_now(std::chrono::milliseconds(timeout));
-    steady_timer_.async_wait(
-        std::bind(&AsioTimer::OnTimer, shared_from_this()));
+    steady_timer_.async_wait(BindTaskNodeAllocator(
+        std::bind(&AsioTimer::OnTimer, shared_from_this())));
   }
 }
 
@@ -31,12 +33,13 @@ void AsioTimer::Close() {
 
 void AsioTimer::OnTimer() {
   if (timer_callback_ && !is_closed_) {
+    BEE_TRACE_SCOPE("timer", "AsioTimer::OnTimer");
     timer_callback_();
 
     if (repeat_) {
       steady_timer_.expires_from_now(std::chrono::milliseconds(timeout_));
-      steady_timer_.async_wait(
-          std::bind(&AsioTimer::OnTimer, shared_from_this()));
+      steady_timer_.async_wait(BindTaskNodeAllocator(
+          std::bind(&AsioTimer::OnTimer, shared_from_this())));
     }
   }
 }
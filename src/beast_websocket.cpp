@@ -9,13 +9,9 @@ BeastWebSocket::BeastWebSocket(std::shared_ptr<boost::asio::io_context> ioc)
       resolver_(net::make_strand(*ioc)),
       ws_(net::make_strand(*ioc)),
       ssl_context_({ssl::context::sslv23_client}),
-      wss_(net::make_strand(*ioc), ssl_context_) {
-  printf("BeastWebSocket created\n");
-}
+      wss_(net::make_strand(*ioc), ssl_context_) {}
 
-BeastWebSocket::~BeastWebSocket() {
-  printf("BeastWebSocket deleted\n");
-}
+BeastWebSocket::~BeastWebSocket() {}
 
 int32_t BeastWebSocket::Open(const std::string& url,
                              const std::vector<std::string>& protocols,
@@ -47,9 +43,11 @@ int32_t BeastWebSocket::Open(const std::string& url,
          url_.c_str(), scheme_.c_str(), host_.c_str(), port_.c_str(),
          path_.c_str(), over_ssl_ ? "true" : "false");
 
-  resolver_.async_resolve(host, port,
-                          beast::bind_front_handler(&BeastWebSocket::OnResolve,
-                                                    shared_from_this()));
+  BEE_TRACE_ASYNC_BEGIN("websocket", "Resolve", this);
+  resolver_.async_resolve(
+      host, port,
+      BindTaskNodeAllocator(beast::bind_front_handler(
+          &BeastWebSocket::OnResolve, shared_from_this())));
 
   state_ = STATE_RESOLVING;
   return kBeeErrorCode_Success;
@@ -79,6 +77,7 @@ void BeastWebSocket::Close() {
 
 void BeastWebSocket::OnResolve(const beast::error_code& ec,
                                const tcp::resolver::results_type& results) {
+  BEE_TRACE_ASYNC_END("websocket", "Resolve", this);
   if (state_ != STATE_RESOLVING) {
     return;
   }
@@ -107,6 +106,7 @@ void BeastWebSocket::OnResolve(const beast::error_code& ec,
 void BeastWebSocket::OnConnect(
     const beast::error_code& ec,
     const tcp::resolver::results_type::endpoint_type& ep) {
+  BEE_TRACE_ASYNC_END("websocket", "Connect", this);
   if (state_ != STATE_CONNECTING) {
     return;
   }
@@ -126,23 +126,26 @@ void BeastWebSocket::OnConnect(
         std::chrono::milliseconds(ws_handshake_timeout_),
         websocket::stream_base::none(), false};
     ws_.set_option(opt);
+    BEE_TRACE_ASYNC_BEGIN("websocket", "WsHandshake", this);
     ws_.async_handshake(
         host_, path_,
-        beast::bind_front_handler(&BeastWebSocket::OnWsHandshake,
-                                  shared_from_this()));
+        BindTaskNodeAllocator(beast::bind_front_handler(
+            &BeastWebSocket::OnWsHandshake, shared_from_this())));
     state_ = STATE_WS_HANDSHAKING;
   } else {
     beast::get_lowest_layer(ws_).expires_after(
         std::chrono::milliseconds(ssl_handshake_timeout_));
+    BEE_TRACE_ASYNC_BEGIN("websocket", "SslHandshake", this);
     wss_.next_layer().async_handshake(
         ssl::stream_base::client,
-        beast::bind_front_handler(&BeastWebSocket::OnSslHandshake,
-                                  shared_from_this()));
+        BindTaskNodeAllocator(beast::bind_front_handler(
+            &BeastWebSocket::OnSslHandshake, shared_from_this())));
     state_ = STATE_SSL_HANDSHAKING;
   }
 }
 
 void BeastWebSocket::OnSslHandshake(const beast::error_code& ec) {
+  BEE_TRACE_ASYNC_END("websocket", "SslHandshake", this);
   if (state_ != STATE_SSL_HANDSHAKING) {
     return;
   }
@@ -161,13 +164,16 @@ void BeastWebSocket::OnSslHandshake(const beast::error_code& ec) {
       std::chrono::milliseconds(ws_handshake_timeout_),
       websocket::stream_base::none(), false};
   wss_.set_option(opt);
-  wss_.async_handshake(host_, path_,
-                       beast::bind_front_handler(&BeastWebSocket::OnWsHandshake,
-                                                 shared_from_this()));
+  BEE_TRACE_ASYNC_BEGIN("websocket", "WsHandshake", this);
+  wss_.async_handshake(
+      host_, path_,
+      BindTaskNodeAllocator(beast::bind_front_handler(
+          &BeastWebSocket::OnWsHandshake, shared_from_this())));
   state_ = STATE_WS_HANDSHAKING;
 }
 
 void BeastWebSocket::OnWsHandshake(const beast::error_code& ec) {
+  BEE_TRACE_ASYNC_END("websocket", "WsHandshake", this);
   if (state_ != STATE_WS_HANDSHAKING) {
     return;
   }
@@ -190,25 +196,28 @@ void BeastWebSocket::OnWsHandshake(const beast::error_code& ec) {
 
 void BeastWebSocket::OnWrite(const beast::error_code& ec,
                              std::size_t bytes_transferred) {
+  BEE_TRACE_ASYNC_END("websocket", "Write", this);
   if (ec) {
     ReportError(kBeeErrorCode_Write_Fail, ec.message());
     state_ = STATE_IDLE;
     return;
   }
-
-  printf("Write %u bytes\n", bytes_transferred);
 }
 
 void BeastWebSocket::OnRead(const beast::error_code& ec,
                             std::size_t bytes_transferred) {
+  BEE_TRACE_ASYNC_END("websocket", "Read", this);
   if (ec) {
     ReportError(kBeeErrorCode_Read_Fail, ec.message());
     state_ = STATE_IDLE;
     return;
   }
 
-  printf("Read %u bytes\n", bytes_transferred);
-  printf("Read:%s\n", beast::buffers_to_string(read_buffer_.data()).c_str());
+  // Deliver the message and drop it from the buffer, or the buffer keeps
+  // growing with every message.
+  ReportData(static_cast<const char*>(read_buffer_.data().data()),
+             read_buffer_.size());
+  read_buffer_.consume(read_buffer_.size());
 
   if (!over_ssl_) {
     AsyncRead(ws_);
@@ -8,6 +8,8 @@
 #include "boost/beast/ssl.hpp"
 #include "boost/beast/websocket.hpp"
 #include "boost/beast/websocket/ssl.hpp"
+#include "task_node_pool.h"
+#include "trace.h"
 #include "websocket.h"
 
 namespace beast = boost::beast;          // from <boost/beast.hpp>
@@ -23,6 +25,12 @@ static const int32_t kDefaultSSLHandshakeTimeout = 10000;
 static const int32_t kDefaultWsHandshakeTimeout = 10000;
 static const int32_t kDefaultWebSocketCloseTimeout = 1000;
 
+// TCP stream bound to a strand directly. beast::tcp_stream holds a type erased
+// any_io_executor, which allocates to hold a strand and is copied by every
+// step of a composed operation.
+typedef beast::basic_stream<tcp, net::strand<net::io_context::executor_type>>
+    StrandTcpStream;
+
 // WebSocket implentation base on Boost.Beast.
 class BeastWebSocket : public WebSocket,
                        public std::enable_shared_from_this<BeastWebSocket> {
@@ -114,9 +122,9 @@ class BeastWebSocket : public WebSocket,
 
   std::shared_ptr<boost::asio::io_context> ioc_;
   tcp::resolver resolver_;
-  websocket::stream<beast::tcp_stream> ws_;
+  websocket::stream<StrandTcpStream> ws_;
   ssl::context ssl_context_;
-  websocket::stream<beast::ssl_stream<beast::tcp_stream>> wss_;
+  websocket::stream<beast::ssl_stream<StrandTcpStream>> wss_;
   std::weak_ptr<WebSocketSink> callback_;
   std::vector<std::string> protocols_;
   int32_t connect_timeout_ = kDefaultWebSocketConnectTimeout;
@@ -140,22 +148,26 @@ void BeastWebSocket::AsyncConnect(WsType& ws,
                                   const tcp::resolver::results_type& results) {
   beast::get_lowest_layer(ws).expires_after(
       std::chrono::milliseconds(connect_timeout_));
+  BEE_TRACE_ASYNC_BEGIN("websocket", "Connect", this);
   beast::get_lowest_layer(ws).async_connect(
-      results, beast::bind_front_handler(&BeastWebSocket::OnConnect,
-                                         shared_from_this()));
+      results, BindTaskNodeAllocator(beast::bind_front_handler(
+                   &BeastWebSocket::OnConnect, shared_from_this())));
 }
 
 template <class WsType>
 void BeastWebSocket::AsyncWrite(WsType& ws, const char* buffer, size_t size) {
-  ws.async_write(
-      net::buffer(buffer, size),
-      beast::bind_front_handler(&BeastWebSocket::OnWrite, shared_from_this()));
+  BEE_TRACE_ASYNC_BEGIN("websocket", "Write", this);
+  ws.async_write(net::buffer(buffer, size),
+                 BindTaskNodeAllocator(beast::bind_front_handler(
+                     &BeastWebSocket::OnWrite, shared_from_this())));
 }
 
 template <class WsType>
 void BeastWebSocket::AsyncRead(WsType& ws) {
-  ws.async_read(read_buffer_, beast::bind_front_handler(&BeastWebSocket::OnRead,
-                                                        shared_from_this()));
+  BEE_TRACE_ASYNC_BEGIN("websocket", "Read", this);
+  ws.async_read(read_buffer_,
+                BindTaskNodeAllocator(beast::bind_front_handler(
+                    &BeastWebSocket::OnRead, shared_from_this())));
 }
 
 template <class WsType>
@@ -172,8 +184,8 @@ void BeastWebSocket::Close(WsType& ws) {
       // Trigger updating idle timer by calling async_read_some.
       std::unique_ptr<char[]> buff(new char[16]());
       ws.async_read_some(boost::asio::buffer(buff.get(), 16),
-                         beast::bind_front_handler(&BeastWebSocket::OnReadSome,
-                                                   shared_from_this()));
+                         BindTaskNodeAllocator(beast::bind_front_handler(
+                             &BeastWebSocket::OnReadSome, shared_from_this())));
 
       // Sync close and must return after close_timeout_.
       boost::system::error_code ec;
@@ -197,8 +209,9 @@ void BeastWebSocket::Close(WsType& ws) {
 
       // Call async_close, will update handshake timer.
       ws.async_close(websocket::close_code::normal,
-                     beast::bind_front_handler(&BeastWebSocket::OnClose,
-                                               shared_from_this(), promise));
+                     BindTaskNodeAllocator(beast::bind_front_handler(
+                         &BeastWebSocket::OnClose, shared_from_this(),
+                         promise)));
 
       // Update state.
       state_ = STATE_CLOSING;
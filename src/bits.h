@@ -0,0 +1,49 @@
+﻿#ifndef BEE_BITS_H
+#define BEE_BITS_H
+
+#include <stdint.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace bee {
+
+// Index of the highest set bit of |value|, which must not be 0.
+inline int32_t HighestBit(uint64_t value) {
+#if defined(__GNUC__)
+  return 63 - __builtin_clzll(value);
+#elif defined(_MSC_VER) && defined(_WIN64)
+  unsigned long index = 0;
+  _BitScanReverse64(&index, value);
+  return static_cast<int32_t>(index);
+#else
+  int32_t index = 0;
+  while (value >>= 1) {
+    ++index;
+  }
+  return index;
+#endif
+}
+
+// Index of the lowest set bit of |value|, which must not be 0.
+inline int32_t LowestBit(uint64_t value) {
+#if defined(__GNUC__)
+  return __builtin_ctzll(value);
+#elif defined(_MSC_VER) && defined(_WIN64)
+  unsigned long index = 0;
+  _BitScanForward64(&index, value);
+  return static_cast<int32_t>(index);
+#else
+  int32_t index = 0;
+  while ((value & 1) == 0) {
+    value >>= 1;
+    ++index;
+  }
+  return index;
+#endif
+}
+
+}  // namespace bee
+
+#endif  // BEE_BITS_H
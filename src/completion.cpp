@@ -0,0 +1,113 @@
+﻿#include "completion.h"
+
+#include <thread>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#elif defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace bee {
+
+namespace {
+
+// Spin iterations before sleeping, roughly a few microseconds.
+const int32_t kSpinCount = 2000;
+
+void CpuRelax() {
+#if defined(_MSC_VER)
+  YieldProcessor();
+#elif defined(__i386__) || defined(__x86_64__)
+  _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+// Spinning only makes sense when the notifier can run at the same time.
+int32_t SpinCount() {
+  static const int32_t spin_count =
+      (std::thread::hardware_concurrency() > 1) ? kSpinCount : 0;
+  return spin_count;
+}
+
+#if defined(__linux__)
+void FutexWait(std::atomic<int32_t>* address, int32_t expected) {
+  syscall(SYS_futex, reinterpret_cast<int32_t*>(address), FUTEX_WAIT_PRIVATE,
+          expected, nullptr, nullptr, 0);
+}
+
+void FutexWake(std::atomic<int32_t>* address) {
+  syscall(SYS_futex, reinterpret_cast<int32_t*>(address), FUTEX_WAKE_PRIVATE,
+          1, nullptr, nullptr, 0);
+}
+#endif
+
+}  // namespace
+
+Completion::Completion() : state_(STATE_PENDING) {}
+
+void Completion::Notify() {
+#if defined(__linux__)
+  // Waking a futex of a destroyed object is harmless, the kernel only uses
+  // the address as a key, and waiters handle spurious wakeups.
+  if (state_.exchange(STATE_DONE) == STATE_SLEEPING) {
+    FutexWake(&state_);
+  }
+#else
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (state_.exchange(STATE_DONE) == STATE_SLEEPING) {
+    cond_.notify_one();
+  }
+#endif
+}
+
+void Completion::Wait() {
+  int32_t spin_count = SpinCount();
+  for (int32_t i = 0; i < spin_count; ++i) {
+    if (state_.load(std::memory_order_acquire) == STATE_DONE) {
+#if !defined(__linux__)
+      // Notify() publishes DONE under the lock, wait for it to unlock before
+      // the caller may destroy the object.
+      std::lock_guard<std::mutex> lock(mutex_);
+#endif
+      return;
+    }
+    CpuRelax();
+  }
+
+  int32_t expected = STATE_PENDING;
+#if defined(__linux__)
+  if (!state_.compare_exchange_strong(expected, STATE_SLEEPING)) {
+    return;
+  }
+  while (state_.load(std::memory_order_acquire) != STATE_DONE) {
+    FutexWait(&state_, STATE_SLEEPING);
+  }
+#else
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!state_.compare_exchange_strong(expected, STATE_SLEEPING)) {
+    return;
+  }
+  cond_.wait(lock, [this] {
+    return state_.load(std::memory_order_acquire) == STATE_DONE;
+  });
+#endif
+}
+
+bool Completion::Done() const {
+#if !defined(__linux__)
+  // Same as Wait(), the notifier may still hold the lock.
+  std::lock_guard<std::mutex> lock(mutex_);
+#endif
+  return state_.load(std::memory_order_acquire) == STATE_DONE;
+}
+
+}  // namespace bee
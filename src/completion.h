@@ -0,0 +1,46 @@
+﻿#ifndef BEE_COMPLETION_H
+#define BEE_COMPLETION_H
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+namespace bee {
+
+// One shot event between a waiter and a notifier on different threads, cheap
+// enough to live on the stack of the waiter.
+// The waiter spins for a short while first, for the notifier usually comes
+// soon, then sleeps on futex on Linux, or condition variable elsewhere.
+// The notifier must not touch the object after Notify() returns, for the
+// waiter may have destroyed it.
+class Completion {
+ public:
+  Completion();
+  ~Completion() = default;
+
+  // Wake the waiter, call once.
+  void Notify();
+
+  // Wait until Notify() is called.
+  void Wait();
+
+  // Return if Notify() has been called.
+  bool Done() const;
+
+ private:
+  enum State { STATE_PENDING, STATE_SLEEPING, STATE_DONE };
+
+  Completion(const Completion&) = delete;
+  Completion& operator=(const Completion&) = delete;
+
+  std::atomic<int32_t> state_;
+#if !defined(__linux__)
+  mutable std::mutex mutex_;
+  std::condition_variable cond_;
+#endif
+};
+
+}  // namespace bee
+
+#endif  // BEE_COMPLETION_H
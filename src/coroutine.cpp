@@ -0,0 +1,317 @@
+﻿#include "coroutine.h"
+
+#if defined(BEE_HAS_COROUTINE)
+
+#include "bee_define.h"
+#include "http.h"
+#include "io_service.h"
+
+namespace bee {
+
+namespace {
+
+// Size of buffer for reading http response body.
+const uint64_t kHttpReadBufferSize = 32 * 1024;
+
+// Task resuming a coroutine, which is resumed with |*resumed| false by
+// |discarded| if the task is dropped without running.
+class CoroutineResumer : public FunctorWrapper {
+ public:
+  CoroutineResumer(std::coroutine_handle<> handle,
+                   bool* resumed,
+                   std::shared_ptr<DiscardedCoroutines> discarded)
+      : handle_(handle), resumed_(resumed), discarded_(std::move(discarded)) {}
+
+  void run() override {
+    *resumed_ = true;
+    handle_.resume();
+  }
+
+  void discard() override {
+    *resumed_ = false;
+    discarded_->Add(handle_);
+    delete this;
+  }
+
+ private:
+  ~CoroutineResumer() override {}
+
+  std::coroutine_handle<> handle_;
+  bool* resumed_;
+  std::shared_ptr<DiscardedCoroutines> discarded_;
+};
+
+}  // namespace
+
+// Http callback collecting the whole response for HttpGetAwaiter.
+class HttpResponseReader : public HttpCallback {
+ public:
+  HttpResponseReader(Http* http, std::coroutine_handle<> handle)
+      : http_(http), handle_(handle) {}
+
+  void OnRedirectReceived(Cronet_UrlRequestPtr request,
+                          Cronet_UrlResponseInfoPtr info,
+                          Cronet_String newLocationUrl) override {
+    Check(http_->FollowRedirect());
+  }
+
+  void OnResponseStarted(Cronet_UrlRequestPtr request,
+                         Cronet_UrlResponseInfoPtr info) override {
+    response_.status_code = Cronet_UrlResponseInfo_http_status_code_get(info);
+    Cronet_BufferPtr buffer = Cronet_Buffer_Create();
+    Cronet_Buffer_InitWithAlloc(buffer, kHttpReadBufferSize);
+    Check(http_->Read(buffer));
+  }
+
+  void OnReadCompleted(Cronet_UrlRequestPtr request,
+                       Cronet_UrlResponseInfoPtr info,
+                       Cronet_BufferPtr buffer,
+                       uint64_t bytes_read) override {
+    response_.body.append(
+        static_cast<const char*>(Cronet_Buffer_GetData(buffer)),
+        static_cast<size_t>(bytes_read));
+    Check(http_->Read(buffer));
+  }
+
+  void OnSucceeded(Cronet_UrlRequestPtr request,
+                   Cronet_UrlResponseInfoPtr info) override {
+    Finish();
+  }
+
+  void OnFailed(Cronet_UrlRequestPtr request,
+                Cronet_UrlResponseInfoPtr info,
+                Cronet_ErrorPtr error) override {
+    response_.error_code = kBeeErrorCode_Read_Fail;
+    response_.error_message = Cronet_Error_message_get(error);
+    Finish();
+  }
+
+  void OnCanceled(Cronet_UrlRequestPtr request,
+                  Cronet_UrlResponseInfoPtr info) override {
+    if (response_.error_code == kBeeErrorCode_Success) {
+      response_.error_code = kBeeErrorCode_Read_Fail;
+      response_.error_message = "Request canceled";
+    }
+    Finish();
+  }
+
+  HttpResponse TakeResponse() { return std::move(response_); }
+
+ private:
+  // Cancel the request if |ret| is an error, OnCanceled() finishes it.
+  void Check(int32_t ret) {
+    if (ret != kBeeErrorCode_Success) {
+      response_.error_code = ret;
+      http_->Cancel();
+    }
+  }
+
+  void Finish() { handle_.resume(); }
+
+  Http* http_;
+  std::coroutine_handle<> handle_;
+  HttpResponse response_;
+};
+
+void DiscardedCoroutines::Add(std::coroutine_handle<> handle) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!closed_) {
+      handles_.push_back(handle);
+      return;
+    }
+  }
+  handle.resume();
+}
+
+void DiscardedCoroutines::ResumeAll(bool close) {
+  // A resumed coroutine may get another task dropped, so repeat until no
+  // more is added.
+  while (true) {
+    std::vector<std::coroutine_handle<>> handles;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (handles_.empty()) {
+        closed_ = close;
+        return;
+      }
+      handles.swap(handles_);
+    }
+    for (std::coroutine_handle<> handle : handles) {
+      handle.resume();
+    }
+  }
+}
+
+bool IOServiceAwaiter::await_suspend(std::coroutine_handle<> handle) {
+  // Not suspended if stopped already, so a coroutine scheduling again after
+  // a false result doesn't nest a resume per attempt.
+  if (!io_service_->running_) {
+    return false;
+  }
+
+  // Nothing of the awaiter is touched after posting, for the coroutine may
+  // have been resumed on another thread.
+  FunctorWrapper* resumer = new CoroutineResumer(
+      handle, &resumed_, io_service_->discarded_coroutines_);
+  if (delay_ > 0) {
+    io_service_->PostDelayedInternal(resumer, delay_, nullptr);
+  } else {
+    io_service_->PostInternal(resumer, priority_);
+  }
+  return true;
+}
+
+bool HttpGetAwaiter::await_suspend(std::coroutine_handle<> handle) {
+  // Http holds callback weakly, the awaiter keeps it until resumed.
+  reader_ = std::make_shared<HttpResponseReader>(http_, handle);
+  int32_t ret = http_->Get(url_, reader_);
+  if (ret != kBeeErrorCode_Success) {
+    reader_.reset();
+    response_.error_code = ret;
+    return false;
+  }
+  return true;
+}
+
+HttpResponse HttpGetAwaiter::await_resume() {
+  if (reader_ != nullptr) {
+    return reader_->TakeResponse();
+  }
+  return std::move(response_);
+}
+
+bool CoWebSocket::OpenAwaiter::await_suspend(std::coroutine_handle<> handle) {
+  if (websocket_->websocket_ == nullptr) {
+    result_ = kBeeErrorCode_Null_Pointer;
+    return false;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(websocket_->mutex_);
+    websocket_->opener_ = handle;
+  }
+
+  int32_t ret = websocket_->websocket_->Open(url_, protocols_,
+                                             websocket_->shared_from_this());
+  if (ret != kBeeErrorCode_Success) {
+    std::lock_guard<std::mutex> lock(websocket_->mutex_);
+    websocket_->opener_ = nullptr;
+    result_ = ret;
+    return false;
+  }
+  return true;
+}
+
+int32_t CoWebSocket::OpenAwaiter::await_resume() {
+  if (result_ != kBeeErrorCode_Success) {
+    return result_;
+  }
+  std::lock_guard<std::mutex> lock(websocket_->mutex_);
+  return websocket_->open_result_;
+}
+
+bool CoWebSocket::ReadAwaiter::await_suspend(std::coroutine_handle<> handle) {
+  std::lock_guard<std::mutex> lock(websocket_->mutex_);
+  if (!websocket_->messages_.empty() || websocket_->finished_) {
+    return false;
+  }
+  websocket_->reader_ = handle;
+  return true;
+}
+
+WebSocketMessage CoWebSocket::ReadAwaiter::await_resume() {
+  std::lock_guard<std::mutex> lock(websocket_->mutex_);
+  if (websocket_->messages_.empty()) {
+    return websocket_->finish_message_;
+  }
+  WebSocketMessage message = std::move(websocket_->messages_.front());
+  websocket_->messages_.pop_front();
+  return message;
+}
+
+CoWebSocket::CoWebSocket(std::shared_ptr<WebSocket> websocket)
+    : websocket_(std::move(websocket)),
+      open_result_(kBeeErrorCode_Success),
+      finished_(false) {}
+
+CoWebSocket::~CoWebSocket() {}
+
+int32_t CoWebSocket::Send(const char* buffer, size_t size) {
+  if (websocket_ == nullptr) {
+    return kBeeErrorCode_Null_Pointer;
+  }
+  return websocket_->Send(buffer, size);
+}
+
+void CoWebSocket::Close() {
+  if (websocket_ != nullptr) {
+    websocket_->Close();
+  }
+}
+
+void CoWebSocket::OnOpen() {
+  std::coroutine_handle<> opener;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    open_result_ = kBeeErrorCode_Success;
+    opener = std::exchange(opener_, nullptr);
+  }
+  if (opener) {
+    opener.resume();
+  }
+}
+
+void CoWebSocket::OnData(const char* buffer, size_t size) {
+  std::coroutine_handle<> reader;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    WebSocketMessage message;
+    message.data.assign(buffer, size);
+    messages_.push_back(std::move(message));
+    reader = std::exchange(reader_, nullptr);
+  }
+  if (reader) {
+    reader.resume();
+  }
+}
+
+void CoWebSocket::OnClose() {
+  Finish(kBeeErrorCode_Success, std::string());
+}
+
+void CoWebSocket::OnError(int32_t error_code,
+                          const std::string& error_message) {
+  Finish(error_code, error_message);
+}
+
+void CoWebSocket::Finish(int32_t error_code,
+                         const std::string& error_message) {
+  std::coroutine_handle<> opener;
+  std::coroutine_handle<> reader;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished_ = true;
+    finish_message_.error_code = error_code;
+    finish_message_.error_message = error_message;
+    finish_message_.finished = true;
+    // Failed before open, the error goes to the opener.
+    if (opener_) {
+      open_result_ = (error_code != kBeeErrorCode_Success)
+                         ? error_code
+                         : static_cast<int32_t>(kBeeErrorCode_Not_Connected);
+      opener = std::exchange(opener_, nullptr);
+    }
+    reader = std::exchange(reader_, nullptr);
+  }
+  if (opener) {
+    opener.resume();
+  }
+  if (reader) {
+    reader.resume();
+  }
+}
+
+}  // namespace bee
+
+#endif  // BEE_HAS_COROUTINE
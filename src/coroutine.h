@@ -0,0 +1,343 @@
+﻿#ifndef BEE_COROUTINE_H
+#define BEE_COROUTINE_H
+
+// C++20 coroutine support, only compiled when the compiler supports it, so
+// that the C++11 build keeps working without it.
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define BEE_HAS_COROUTINE 1
+#endif
+#endif
+
+#if defined(BEE_HAS_COROUTINE)
+
+#include <stdint.h>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "task_node_pool.h"
+#include "task_scheduler.h"
+#include "websocket.h"
+
+namespace bee {
+
+class Http;
+class HttpResponseReader;
+class IOService;
+
+// Promise base of CoTask, coroutine frames are allocated from TaskNodePool,
+// so frames of short lived coroutines are recycled instead of hitting heap.
+class CoPromiseBase {
+ public:
+  class FinalAwaiter {
+   public:
+    bool await_ready() noexcept { return false; }
+
+    // Resume the awaiting coroutine, or release a detached coroutine.
+    template <class PromiseT>
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<PromiseT> handle) noexcept {
+      CoPromiseBase& promise = handle.promise();
+      if (promise.continuation_) {
+        return promise.continuation_;
+      }
+      if (promise.detached_) {
+        handle.destroy();
+      }
+      return std::noop_coroutine();
+    }
+
+    void await_resume() noexcept {}
+  };
+
+  static void* operator new(size_t size) {
+    return TaskNodePool::Allocate(size);
+  }
+
+  static void operator delete(void* p) { TaskNodePool::Free(p); }
+
+  // Coroutines are lazy, they start when awaited or spawned.
+  std::suspend_always initial_suspend() noexcept { return {}; }
+
+  FinalAwaiter final_suspend() noexcept { return {}; }
+
+  // Exceptions are not used in this library.
+  void unhandled_exception() { std::terminate(); }
+
+  std::coroutine_handle<> continuation_;
+  bool detached_ = false;
+};
+
+template <class T>
+class CoTask;
+
+template <class T>
+class CoPromise : public CoPromiseBase {
+ public:
+  CoTask<T> get_return_object();
+
+  template <class U>
+  void return_value(U&& value) {
+    value_.emplace(std::forward<U>(value));
+  }
+
+  T TakeValue() { return std::move(*value_); }
+
+ private:
+  std::optional<T> value_;
+};
+
+template <>
+class CoPromise<void> : public CoPromiseBase {
+ public:
+  CoTask<void> get_return_object();
+
+  void return_void() {}
+
+  void TakeValue() {}
+};
+
+// Lazy coroutine returning |T|, started by co_await from another coroutine,
+// or by CoSpawn() from anywhere.
+template <class T = void>
+class CoTask {
+ public:
+  typedef CoPromise<T> promise_type;
+
+  CoTask() = default;
+  explicit CoTask(std::coroutine_handle<promise_type> handle)
+      : handle_(handle) {}
+  CoTask(CoTask&& other) : handle_(std::exchange(other.handle_, nullptr)) {}
+  CoTask& operator=(CoTask&& other) {
+    if (this != &other) {
+      Reset();
+      handle_ = std::exchange(other.handle_, nullptr);
+    }
+    return *this;
+  }
+  ~CoTask() { Reset(); }
+
+  bool await_ready() { return !handle_ || handle_.done(); }
+
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) {
+    handle_.promise().continuation_ = awaiting;
+    return handle_;
+  }
+
+  T await_resume() { return handle_.promise().TakeValue(); }
+
+  // Give up the ownership of the coroutine.
+  std::coroutine_handle<promise_type> Release() {
+    return std::exchange(handle_, nullptr);
+  }
+
+ private:
+  CoTask(const CoTask&) = delete;
+  CoTask& operator=(const CoTask&) = delete;
+
+  void Reset() {
+    if (handle_) {
+      handle_.destroy();
+      handle_ = nullptr;
+    }
+  }
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+template <class T>
+CoTask<T> CoPromise<T>::get_return_object() {
+  return CoTask<T>(std::coroutine_handle<CoPromise<T>>::from_promise(*this));
+}
+
+inline CoTask<void> CoPromise<void>::get_return_object() {
+  return CoTask<void>(
+      std::coroutine_handle<CoPromise<void>>::from_promise(*this));
+}
+
+// Start |task| on current thread until its first suspension, the coroutine
+// releases itself when it finishes.
+template <class T>
+void CoSpawn(CoTask<T> task) {
+  std::coroutine_handle<CoPromise<T>> handle = task.Release();
+  if (handle) {
+    handle.promise().detached_ = true;
+    handle.resume();
+  }
+}
+
+// Coroutines whose resume task is dropped by a stopping IOService, resumed
+// by IOService::Stop() after io_context threads are joined, rather than from
+// inside the shutdown path. Shared with the pending resume tasks, for a task
+// may be dropped later by a scheduler outliving a detached thread.
+class DiscardedCoroutines {
+ public:
+  void Add(std::coroutine_handle<> handle);
+
+  // Resume the coroutines added so far. If |close|, the owner is going away
+  // and coroutines added later are resumed right away.
+  void ResumeAll(bool close);
+
+ private:
+  std::mutex mutex_;
+  std::vector<std::coroutine_handle<>> handles_;
+  bool closed_ = false;
+};
+
+// Awaitable of IOService::Schedule() and IOService::Sleep(), resumes the
+// coroutine on io_context thread. The result is false if IOService stopped
+// before that, in which case the coroutine continues at once if IOService
+// was not running, or is resumed at the end of Stop() otherwise, so that it
+// has a chance to clean up.
+class IOServiceAwaiter {
+ public:
+  IOServiceAwaiter(IOService* io_service, TaskPriority priority, int32_t delay)
+      : io_service_(io_service),
+        priority_(priority),
+        delay_(delay),
+        resumed_(false) {}
+
+  bool await_ready() { return false; }
+
+  bool await_suspend(std::coroutine_handle<> handle);
+
+  bool await_resume() { return resumed_; }
+
+ private:
+  IOService* io_service_;
+  TaskPriority priority_;
+  int32_t delay_;
+  bool resumed_;
+};
+
+// Response of co_await Http::Get().
+struct HttpResponse {
+  // kBeeErrorCode_Success, or the error of the request.
+  int32_t error_code = 0;
+  int32_t status_code = 0;
+  std::string error_message;
+  std::string body;
+};
+
+// Awaitable of Http::Get(url), resumes with the whole response on executor
+// thread of the Http object.
+class HttpGetAwaiter {
+ public:
+  HttpGetAwaiter(Http* http, const std::string& url)
+      : http_(http), url_(url) {}
+
+  bool await_ready() { return false; }
+
+  bool await_suspend(std::coroutine_handle<> handle);
+
+  HttpResponse await_resume();
+
+ private:
+  Http* http_;
+  std::string url_;
+  std::shared_ptr<HttpResponseReader> reader_;
+  HttpResponse response_;
+};
+
+// Message of co_await CoWebSocket::Read().
+struct WebSocketMessage {
+  // kBeeErrorCode_Success for data and close, or the error of the socket.
+  int32_t error_code = 0;
+  std::string error_message;
+  // The socket is closed or failed, no more messages.
+  bool finished = false;
+  std::string data;
+};
+
+// WebSocket adapter for coroutines, which queues events of the socket and
+// hands them to the reading coroutine. The coroutine is resumed on io_context
+// thread inside the socket callback.
+class CoWebSocket : public WebSocketSink,
+                    public std::enable_shared_from_this<CoWebSocket> {
+ public:
+  class OpenAwaiter {
+   public:
+    OpenAwaiter(CoWebSocket* websocket,
+                const std::string& url,
+                const std::vector<std::string>& protocols)
+        : websocket_(websocket), url_(url), protocols_(protocols), result_(0) {}
+
+    bool await_ready() { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle);
+
+    // Return kBeeErrorCode_Success when the socket is open.
+    int32_t await_resume();
+
+   private:
+    CoWebSocket* websocket_;
+    std::string url_;
+    std::vector<std::string> protocols_;
+    int32_t result_;
+  };
+
+  class ReadAwaiter {
+   public:
+    explicit ReadAwaiter(CoWebSocket* websocket) : websocket_(websocket) {}
+
+    bool await_ready() { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle);
+
+    WebSocketMessage await_resume();
+
+   private:
+    CoWebSocket* websocket_;
+  };
+
+  explicit CoWebSocket(std::shared_ptr<WebSocket> websocket);
+  ~CoWebSocket();
+
+  // co_await Open() to connect |url|, the result is a BeeErrorCode.
+  OpenAwaiter Open(const std::string& url,
+                   const std::vector<std::string>& protocols =
+                       std::vector<std::string>()) {
+    return OpenAwaiter(this, url, protocols);
+  }
+
+  // co_await Read() for next message, only one coroutine may read at a time.
+  ReadAwaiter Read() { return ReadAwaiter(this); }
+
+  int32_t Send(const char* buffer, size_t size);
+
+  void Close();
+
+  // WebSocketSink implementation.
+  void OnOpen() override;
+
+  void OnData(const char* buffer, size_t size) override;
+
+  void OnClose() override;
+
+  void OnError(int32_t error_code, const std::string& error_message) override;
+
+ private:
+  void Finish(int32_t error_code, const std::string& error_message);
+
+  std::shared_ptr<WebSocket> websocket_;
+  std::mutex mutex_;
+  std::coroutine_handle<> opener_;
+  int32_t open_result_;
+  std::coroutine_handle<> reader_;
+  std::deque<WebSocketMessage> messages_;
+  bool finished_;
+  WebSocketMessage finish_message_;
+};
+
+}  // namespace bee
+
+#endif  // BEE_HAS_COROUTINE
+
+#endif  // BEE_COROUTINE_H
@@ -88,8 +88,6 @@ class FunctionView<RetT(ArgT...)> final {
   // Default constructor. Creates an empty FunctionView.
   FunctionView() : call_(nullptr) {}
 
-  virtual ~FunctionView() {}
-
   RetT operator()(ArgT... args) const {
     return call_(f_, std::forward<ArgT>(args)...);
   }
@@ -124,6 +122,11 @@ class FunctionView<RetT(ArgT...)> final {
   RetT (*call_)(VoidUnion, ArgT...);
 };
 
+static_assert(std::is_trivially_copyable<FunctionView<void()>>::value,
+              "FunctionView must be trivially copyable");
+static_assert(sizeof(FunctionView<void()>) == 2 * sizeof(void*),
+              "FunctionView must be two pointers");
+
 }  // namespace bee
 
 #endif  // BEE_API_FUNCTION_VIEW_H
@@ -0,0 +1,114 @@
+﻿#include "histogram.h"
+
+#include "bits.h"
+
+namespace bee {
+
+namespace {
+
+uint64_t PercentileOf(const uint64_t* counts,
+                      uint64_t count,
+                      double percentile,
+                      uint64_t (*value_of)(int32_t)) {
+  uint64_t rank = static_cast<uint64_t>(count * percentile / 100.0);
+  if (rank >= count) {
+    rank = count - 1;
+  }
+  uint64_t seen = 0;
+  for (int32_t i = 0; i < Histogram::kBucketCount; ++i) {
+    seen += counts[i];
+    if (seen > rank) {
+      return value_of(i);
+    }
+  }
+  return 0;
+}
+
+}  // namespace
+
+Histogram::Histogram() : count_(0), sum_(0), min_(UINT64_MAX), max_(0) {
+  for (int32_t i = 0; i < kBucketCount; ++i) {
+    counts_[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+void Histogram::Record(uint64_t value) {
+  std::atomic<uint64_t>& bucket = counts_[BucketOf(value)];
+  bucket.store(bucket.load(std::memory_order_relaxed) + 1,
+               std::memory_order_relaxed);
+  count_.store(count_.load(std::memory_order_relaxed) + 1,
+               std::memory_order_relaxed);
+  sum_.store(sum_.load(std::memory_order_relaxed) + value,
+             std::memory_order_relaxed);
+  if (value < min_.load(std::memory_order_relaxed)) {
+    min_.store(value, std::memory_order_relaxed);
+  }
+  if (value > max_.load(std::memory_order_relaxed)) {
+    max_.store(value, std::memory_order_relaxed);
+  }
+}
+
+void Histogram::Accumulate(uint64_t* counts,
+                           uint64_t* count,
+                           uint64_t* sum,
+                           uint64_t* min,
+                           uint64_t* max) const {
+  for (int32_t i = 0; i < kBucketCount; ++i) {
+    counts[i] += counts_[i].load(std::memory_order_relaxed);
+  }
+  *count += count_.load(std::memory_order_relaxed);
+  *sum += sum_.load(std::memory_order_relaxed);
+  uint64_t value = min_.load(std::memory_order_relaxed);
+  if (value < *min) {
+    *min = value;
+  }
+  value = max_.load(std::memory_order_relaxed);
+  if (value > *max) {
+    *max = value;
+  }
+}
+
+HistogramStats Histogram::Summarize(const uint64_t* counts,
+                                    uint64_t count,
+                                    uint64_t sum,
+                                    uint64_t min,
+                                    uint64_t max) {
+  HistogramStats stats;
+  if (count == 0) {
+    return stats;
+  }
+  stats.count = count;
+  stats.min = min;
+  stats.max = max;
+  stats.mean = static_cast<double>(sum) / count;
+  stats.p50 = PercentileOf(counts, count, 50.0, &Histogram::ValueOf);
+  stats.p90 = PercentileOf(counts, count, 90.0, &Histogram::ValueOf);
+  stats.p99 = PercentileOf(counts, count, 99.0, &Histogram::ValueOf);
+  stats.p999 = PercentileOf(counts, count, 99.9, &Histogram::ValueOf);
+  return stats;
+}
+
+int32_t Histogram::BucketOf(uint64_t value) {
+  if (value < static_cast<uint64_t>(kSubBucketCount)) {
+    return static_cast<int32_t>(value);
+  }
+  // Keep kSubBucketBits significant bits below the highest one.
+  int32_t shift = HighestBit(value) - kSubBucketBits;
+  int32_t sub_bucket =
+      static_cast<int32_t>(value >> shift) & (kSubBucketCount - 1);
+  return (shift + 1) * kSubBucketCount + sub_bucket;
+}
+
+uint64_t Histogram::ValueOf(int32_t bucket) {
+  if (bucket < kSubBucketCount) {
+    return static_cast<uint64_t>(bucket);
+  }
+  // Middle of the bucket.
+  int32_t shift = bucket / kSubBucketCount - 1;
+  uint64_t low =
+      static_cast<uint64_t>(kSubBucketCount + bucket % kSubBucketCount)
+      << shift;
+  return low + ((1ULL << shift) >> 1);
+}
+
+}  // namespace bee
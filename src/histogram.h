@@ -0,0 +1,70 @@
+﻿#ifndef BEE_HISTOGRAM_H
+#define BEE_HISTOGRAM_H
+
+#include <stdint.h>
+#include <atomic>
+
+namespace bee {
+
+// Summary of a histogram.
+struct HistogramStats {
+  uint64_t count = 0;
+  uint64_t min = 0;
+  uint64_t max = 0;
+  double mean = 0;
+  uint64_t p50 = 0;
+  uint64_t p90 = 0;
+  uint64_t p99 = 0;
+  uint64_t p999 = 0;
+};
+
+// Lock free log linear histogram like HdrHistogram. Values are grouped by
+// power of 2, and each group is split into kSubBucketCount linear buckets, so
+// the relative error of a recorded value is below 1 / kSubBucketCount.
+// A histogram has a single writer, so Record() is a few relaxed loads and
+// stores without any locked instruction, and readers on other threads may
+// accumulate it at any time. Use one histogram per writer thread.
+class Histogram {
+ public:
+  static const int32_t kSubBucketBits = 4;
+  static const int32_t kSubBucketCount = 1 << kSubBucketBits;
+  static const int32_t kBucketCount = (65 - kSubBucketBits) * kSubBucketCount;
+
+  Histogram();
+  ~Histogram() = default;
+
+  // Record |value|, from the writer thread only.
+  void Record(uint64_t value);
+
+  // Add counts of this histogram to |counts| of kBucketCount buckets, and
+  // accumulate |count|, |sum|, |min| and |max|.
+  void Accumulate(uint64_t* counts,
+                  uint64_t* count,
+                  uint64_t* sum,
+                  uint64_t* min,
+                  uint64_t* max) const;
+
+  // Summarize |counts| accumulated from histograms.
+  static HistogramStats Summarize(const uint64_t* counts,
+                                  uint64_t count,
+                                  uint64_t sum,
+                                  uint64_t min,
+                                  uint64_t max);
+
+ private:
+  Histogram(const Histogram&) = delete;
+  Histogram& operator=(const Histogram&) = delete;
+
+  static int32_t BucketOf(uint64_t value);
+  static uint64_t ValueOf(int32_t bucket);
+
+  std::atomic<uint64_t> counts_[kBucketCount];
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> sum_;
+  std::atomic<uint64_t> min_;
+  std::atomic<uint64_t> max_;
+};
+
+}  // namespace bee
+
+#endif  // BEE_HISTOGRAM_H
@@ -1,6 +1,7 @@
 ﻿#include "http.h"
 
 #include "bee_define.h"
+#include "trace.h"
 
 namespace bee {
 
@@ -369,6 +370,7 @@ Http* Http::GetThis(Cronet_UploadDataProviderPtr provider) {
 void Http::OnRedirectReceived(Cronet_UrlRequestPtr request,
                               Cronet_UrlResponseInfoPtr info,
                               Cronet_String newLocationUrl) {
+  BEE_TRACE_SCOPE("cronet", "Http::OnRedirectReceived");
   std::shared_ptr<HttpCallback> http_callback = http_callback_.lock();
   if (http_callback != nullptr) {
     http_callback->OnRedirectReceived(request, info, newLocationUrl);
@@ -377,6 +379,7 @@ void Http::OnRedirectReceived(Cronet_UrlRequestPtr request,
 
 void Http::OnResponseStarted(Cronet_UrlRequestPtr request,
                              Cronet_UrlResponseInfoPtr info) {
+  BEE_TRACE_SCOPE("cronet", "Http::OnResponseStarted");
   std::shared_ptr<HttpCallback> http_callback = http_callback_.lock();
   if (http_callback != nullptr) {
     http_callback->OnResponseStarted(request, info);
@@ -387,6 +390,7 @@ void Http::OnReadCompleted(Cronet_UrlRequestPtr request,
                            Cronet_UrlResponseInfoPtr info,
                            Cronet_BufferPtr buffer,
                            uint64_t bytes_read) {
+  BEE_TRACE_SCOPE("cronet", "Http::OnReadCompleted");
   std::shared_ptr<HttpCallback> http_callback = http_callback_.lock();
   if (http_callback != nullptr) {
     http_callback->OnReadCompleted(request, info, buffer, bytes_read);
@@ -395,6 +399,7 @@ void Http::OnReadCompleted(Cronet_UrlRequestPtr request,
 
 void Http::OnSucceeded(Cronet_UrlRequestPtr request,
                        Cronet_UrlResponseInfoPtr info) {
+  BEE_TRACE_SCOPE("cronet", "Http::OnSucceeded");
   finished_ = true;
   std::shared_ptr<HttpCallback> http_callback = http_callback_.lock();
   if (http_callback != nullptr) {
@@ -405,6 +410,7 @@ void Http::OnSucceeded(Cronet_UrlRequestPtr request,
 void Http::OnFailed(Cronet_UrlRequestPtr request,
                     Cronet_UrlResponseInfoPtr info,
                     Cronet_ErrorPtr error) {
+  BEE_TRACE_SCOPE("cronet", "Http::OnFailed");
   finished_ = true;
   std::shared_ptr<HttpCallback> http_callback = http_callback_.lock();
   if (http_callback != nullptr) {
@@ -414,6 +420,7 @@ void Http::OnFailed(Cronet_UrlRequestPtr request,
 
 void Http::OnCanceled(Cronet_UrlRequestPtr request,
                       Cronet_UrlResponseInfoPtr info) {
+  BEE_TRACE_SCOPE("cronet", "Http::OnCanceled");
   finished_ = true;
   // Do not report OnCanceled if close directly.
   if (close_promise_ != nullptr) {
@@ -7,7 +7,9 @@
 #include <string>
 #include <vector>
 
+#include "coroutine.h"
 #include "cronet_c.h"
+#include "unique_function.h"
 
 namespace bee {
 
@@ -31,7 +33,8 @@ class HttpExecutor {
   // virtual functions.
   virtual void ExecuteRunnable(Cronet_RunnablePtr runnable) = 0;
 
-  virtual void ExecuteFunction(std::function<void()> function) = 0;
+  // Run |function| on the executor, it's moved all the way to the task.
+  virtual void ExecuteFunction(UniqueFunction<void()> function) = 0;
 
   virtual bool IsExecutorThread() = 0;
 
@@ -115,6 +118,14 @@ class Http {
                std::shared_ptr<HttpProvider> provider,
                std::shared_ptr<HttpCallback> callback);
 
+#if defined(BEE_HAS_COROUTINE)
+  // co_await Get() to fetch |url| with the whole response, redirects are
+  // followed.
+  HttpGetAwaiter Get(const std::string& url) {
+    return HttpGetAwaiter(this, url);
+  }
+#endif
+
   int32_t FollowRedirect();
 
   int32_t Read(Cronet_BufferPtr buffer);
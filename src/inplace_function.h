@@ -0,0 +1,26 @@
+﻿#ifndef BEE_INPLACE_FUNCTION_H
+#define BEE_INPLACE_FUNCTION_H
+
+#include <stddef.h>
+
+#include "unique_function.h"
+
+namespace bee {
+
+// Owning sibling of FunctionView, which keeps its callable in a buffer of
+// |Capacity| bytes inside the object and never allocates. A callable larger
+// than |Capacity| fails to compile rather than falling back to heap, so it
+// suits hot paths where an allocation is a bug, and UniqueFunction is the
+// choice when the callable size is not under control.
+// Like UniqueFunction it's move-only, so move-only captures are accepted.
+//
+// Example use:
+//
+//   InplaceFunction<void(int), 16> on_event = [this, id](int code) { ... };
+//   on_event(0);
+template <typename T, size_t Capacity = kUniqueFunctionInlineSize>
+using InplaceFunction = function_internal::MoveOnlyFunction<T, Capacity, false>;
+
+}  // namespace bee
+
+#endif  // BEE_INPLACE_FUNCTION_H
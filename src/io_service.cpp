@@ -3,6 +3,10 @@
 #include "beast_websocket.h"
 #include "bee_define.h"
 #include "boost/asio/io_context.hpp"
+#include "task_scheduler.h"
+#include "task_watchdog.h"
+#include "thread_cache.h"
+#include "timing_wheel.h"
 
 namespace boost {
 namespace asio {
@@ -23,34 +27,112 @@ const char kUserAgent[] = "Roblin";
 thread_local IOService* IOService::self_ = nullptr;
 
 IOService::IOService(std::shared_ptr<HttpEngine> http_engine)
-    : http_engine_(http_engine), running_(false) {}
+    : spare_ioc_concurrency_(0),
+      thread_count_(0),
+      priority_policy_(TASK_PRIORITY_POLICY_WEIGHTED),
+      task_queue_backend_(TASK_QUEUE_BACKEND_MUTEX),
+      stats_enabled_(false),
+      stats_sample_interval_(16),
+      slow_task_threshold_(0),
+      busy_poll_duration_(0),
+      http_engine_(http_engine),
+      running_(false) {}
 
 IOService::~IOService() {
   Stop();
+#if defined(BEE_HAS_COROUTINE)
+  discarded_coroutines_->ResumeAll(true);
+#endif
 }
 
-bool IOService::Start() {
+bool IOService::Start(int32_t thread_count, const ThreadOptions& options) {
   bool ret = true;
   do {
     if (running_) {
       break;
     }
 
-    // Create io_context.
-    ioc_.reset(new boost::asio::io_context);
+    if (thread_count <= 0) {
+      ret = false;
+      break;
+    }
+
+    // Create io_context, with concurrency hint of thread count, or reuse the
+    // one of last run. Handlers left in it by last run are no-ops now.
+    if (spare_ioc_ != nullptr && spare_ioc_concurrency_ == thread_count) {
+      ioc_ = std::move(spare_ioc_);
+      ioc_->restart();
+    } else {
+      ioc_.reset(new boost::asio::io_context(thread_count));
+    }
+    spare_ioc_.reset();
 
     // Create io_service_work to keep io_context running.
     work_.reset(new boost::asio::io_service_work(*ioc_));
 
-    // Create thread for io_context run().
-    thread_.reset(new std::thread([this] { ioc_->run(); }));
+    // Create task scheduler, with a work stealing queue for each thread in
+    // each priority lane.
+    scheduler_ = std::make_shared<TaskScheduler>(
+        ioc_.get(), thread_count, priority_policy_, task_queue_backend_);
+    scheduler_->SetLimits(queue_limits_);
+    if (stats_enabled_) {
+      scheduler_->EnableStats(stats_sample_interval_);
+    }
+    if (slow_task_threshold_ > 0) {
+      scheduler_->EnableWatch();
+    }
 
-    // InitCurrentThread in thread when start running.
-    ioc_->post([this] { InitCurrentThread(); });
+    // Create timing wheel for delayed tasks, driven by one timer.
+    timing_wheel_ = std::make_shared<TimingWheel>(ioc_.get(), scheduler_);
+
+    // Run io_context on threads adopted from ThreadCache, each thread holds a
+    // reference of io_context and scheduler in case the thread is not joined
+    // in Stop().
+    thread_count_ = thread_count;
+    thread_options_ = options;
+    for (int32_t i = 0; i < thread_count; ++i) {
+      std::shared_ptr<boost::asio::io_context> ioc = ioc_;
+      std::shared_ptr<TaskScheduler> scheduler = scheduler_;
+      int32_t busy_poll_duration = busy_poll_duration_;
+      std::unique_ptr<CachedThread> thread = ThreadCache::Run(
+          [this, ioc, scheduler, options, i, busy_poll_duration] {
+            Run(ioc, scheduler, options, i, busy_poll_duration);
+          },
+          options.stack_size);
+      if (thread == nullptr) {
+        printf("Create io_context thread %d failed\n", i);
+        ret = false;
+        break;
+      }
+      threads_.push_back(std::move(thread));
+    }
+    if (!ret) {
+      // Stop the threads created, nothing has been posted yet.
+      scheduler_->Shutdown();
+      timing_wheel_->Shutdown();
+      work_.reset();
+      ioc_->stop();
+      for (auto& thread : threads_) {
+        thread->Join();
+      }
+      threads_.clear();
+      thread_count_ = 0;
+      timing_wheel_.reset();
+      scheduler_.reset();
+      ioc_.reset();
+      break;
+    }
+
+    // Create watchdog of slow tasks.
+    if (slow_task_threshold_ > 0) {
+      watchdog_.reset(new TaskWatchdog(scheduler_, slow_task_threshold_));
+      watchdog_->Start();
+    }
 
     // Now IOService is indeed running.
     running_ = true;
   } while (0);
+
   return ret;
 }
 
@@ -61,36 +143,145 @@ bool IOService::Stop() {
       break;
     }
 
-    // UnInitCurrentThread in thread before thread exits.
-    InvokeInternal([this] { UnInitCurrentThread(); });
+    // Wait for all tasks posted before Stop() being picked up, one marker
+    // per lane since lanes are picked up independently.
+    if (!IsCurrent()) {
+      auto noop = [] {};
+      FunctorInvoker high(noop, Location::Current());
+      FunctorInvoker normal(noop, Location::Current());
+      FunctorInvoker background(noop, Location::Current());
+      scheduler_->Push(&high, TASK_PRIORITY_HIGH);
+      scheduler_->Push(&normal, TASK_PRIORITY_NORMAL);
+      scheduler_->Push(&background, TASK_PRIORITY_BACKGROUND);
+      high.wait();
+      normal.wait();
+      background.wait();
+    }
 
     // From this time on, no new invoke is allowed.
     running_ = false;
 
+    // No task will be executed any more, delayed tasks are deleted.
+    scheduler_->Shutdown();
+    timing_wheel_->Shutdown();
+
+    // Stop watchdog, a slow task running now is not reported any more.
+    watchdog_.reset();
+
     // Stop run() loop, no run() will be called again.
     work_.reset();
 
     // Interrupt current run().
     ioc_->stop();
 
-    // Join the thread until it stopped.
-    if (thread_ != nullptr && !IsCurrent()) {
-      thread_->join();
-      thread_.reset();
+    // Join the threads until they stopped, the current thread is detached
+    // if Stop() is called from one of the io_context threads.
+    bool joined = true;
+    for (auto& thread : threads_) {
+      if (thread->IsCurrent()) {
+        thread->Detach();
+        joined = false;
+      } else {
+        thread->Join();
+      }
     }
+    threads_.clear();
+
+    // Delete tasks left now, drain handlers still queued in io_context keep
+    // the scheduler alive until io_context runs again or is deleted.
+    if (joined) {
+      scheduler_->Clear();
+    }
+
+    // Delete scheduler, tasks left are deleted with it.
+    timing_wheel_.reset();
+    scheduler_.reset();
 
-    // Delete ios.
+    // Keep io_context for next Start() if nothing else refers to it, such as
+    // a detached thread or a timer not deleted yet.
+    if (joined && ioc_.use_count() == 1) {
+      spare_ioc_ = std::move(ioc_);
+      spare_ioc_concurrency_ = thread_count_;
+    }
     ioc_.reset();
+    thread_count_ = 0;
   } while (0);
+
+#if defined(BEE_HAS_COROUTINE)
+  // Resume coroutines dropped above, out of the shutdown path, they see
+  // IOService stopped.
+  discarded_coroutines_->ResumeAll(false);
+#endif
   return ret;
 }
 
-void IOService::InitCurrentThread() {
+void IOService::Run(std::shared_ptr<boost::asio::io_context> ioc,
+                    std::shared_ptr<TaskScheduler> scheduler,
+                    ThreadOptions options,
+                    int32_t index,
+                    int32_t busy_poll_duration) {
+  InitCurrentThread(options, index);
+  scheduler->AttachCurrentThread(index);
+  if (busy_poll_duration > 0) {
+    RunBusyPoll(ioc.get(), busy_poll_duration);
+  } else {
+    ioc->run();
+  }
+  // Never touch this from now on.
+  scheduler->DetachCurrentThread();
+  UnInitCurrentThread(options);
+}
+
+void IOService::RunBusyPoll(boost::asio::io_context* ioc, int32_t duration) {
+  std::chrono::microseconds spin_duration(duration);
+  while (!ioc->stopped()) {
+    // Spin on poll() while handlers keep coming, until idle for
+    // |spin_duration|.
+    std::chrono::steady_clock::time_point idle_since =
+        std::chrono::steady_clock::now();
+    while (!ioc->stopped()) {
+      std::chrono::steady_clock::time_point now =
+          std::chrono::steady_clock::now();
+      if (ioc->poll() > 0) {
+        idle_since = now;
+      } else if (now - idle_since >= spin_duration) {
+        break;
+      }
+    }
+
+    // Block until the next handler, then spin again.
+    ioc->run_one();
+  }
+}
+
+void IOService::InitCurrentThread(const ThreadOptions& options,
+                                  int32_t index) {
   self_ = this;
+  PlatformThread::ApplyOptions(options, index);
 }
 
-void IOService::UnInitCurrentThread() {
+void IOService::UnInitCurrentThread(const ThreadOptions& options) {
   OPENSSL_thread_stop();
+  // The thread goes back to ThreadCache, undo the options, or let the thread
+  // exit if they can't be undone.
+  if (!PlatformThread::ResetOptions(options)) {
+    ThreadCache::DiscardCurrentThread();
+  }
+  self_ = nullptr;
+}
+
+const char* IOService::IoBackend() {
+#if defined(BOOST_ASIO_HAS_IO_URING_AS_DEFAULT)
+  return "io_uring";
+#elif defined(BOOST_ASIO_HAS_IOCP)
+  return "iocp";
+#elif defined(BOOST_ASIO_HAS_EPOLL)
+  return "epoll";
+#elif defined(BOOST_ASIO_HAS_KQUEUE)
+  return "kqueue";
+#else
+  return "select";
+#endif
 }
 
 bool IOService::IsCurrent() {
@@ -108,8 +299,8 @@ void IOService::ExecuteRunnable(Cronet_RunnablePtr runnable) {
   }
 }
 
-void IOService::ExecuteFunction(std::function<void()> function) {
-  PostTask(function);
+void IOService::ExecuteFunction(UniqueFunction<void()> function) {
+  PostTask(std::move(function));
 }
 
 bool IOService::IsExecutorThread() {
@@ -137,25 +328,65 @@ std::shared_ptr<Timer> IOService::CreateTimer() {
   return std::make_shared<AsioTimer>(ioc_);
 }
 
-void IOService::InvokeInternal(FunctionView<void()> functor) {
-  std::shared_ptr<FunctorInvoker> functor_wrapper(new FunctorInvoker(functor));
-  bool posted = false;
+void IOService::InvokeInternal(FunctionView<void()> functor,
+                               const Location& location) {
   if (IsCurrent()) {
-    functor_wrapper->run();
+    functor();
+    return;
+  }
+
+  if (running_ && scheduler_ != nullptr) {
+    // The invoker stays on stack, scheduler either executes or discards it,
+    // both wake us up.
+    FunctorInvoker functor_wrapper(functor, location);
+    scheduler_->Push(&functor_wrapper);
+    functor_wrapper.wait();
+  }
+}
+
+size_t IOService::QueueDepth(TaskPriority priority) {
+  if (!running_ || scheduler_ == nullptr) {
+    return 0;
+  }
+  return scheduler_->QueueDepth(priority);
+}
+
+IOServiceStats IOService::GetStats() {
+  if (!running_ || scheduler_ == nullptr) {
+    return IOServiceStats();
+  }
+  return scheduler_->GetStats();
+}
+
+void IOService::PostTasks(TaskBatch& batch, TaskPriority priority) {
+  if (batch.Empty()) {
+    return;
+  }
+
+  if (running_ && scheduler_ != nullptr) {
+    scheduler_->PushBatch(batch.head_, batch.tail_, batch.size_, priority);
+    batch.Reset();
   } else {
-    if (running_ && ioc_ != nullptr) {
-      ioc_->post([functor_wrapper] { functor_wrapper->run(); });
-      posted = true;
-    }
+    batch.Clear();
   }
-  if (running_ && posted) {
-    functor_wrapper->wait();
+}
+
+void IOService::PostInternal(FunctorWrapper* functor_wrapper,
+                             TaskPriority priority) {
+  if (running_ && scheduler_ != nullptr && functor_wrapper != nullptr) {
+    scheduler_->Push(functor_wrapper, priority);
+  } else if (functor_wrapper != nullptr) {
+    functor_wrapper->discard();
   }
 }
 
-void IOService::PostInternal(std::shared_ptr<FunctorWrapper> functor_wrapper) {
-  if (running_ && ioc_ != nullptr && functor_wrapper != nullptr) {
-    ioc_->post([functor_wrapper] { functor_wrapper->run(); });
+void IOService::PostDelayedInternal(FunctorWrapper* functor_wrapper,
+                                    int32_t delay,
+                                    TaskHandle* handle) {
+  if (running_ && timing_wheel_ != nullptr && functor_wrapper != nullptr) {
+    timing_wheel_->Schedule(functor_wrapper, delay, handle);
+  } else if (functor_wrapper != nullptr) {
+    functor_wrapper->discard();
   }
 }
 
@@ -0,0 +1,214 @@
+﻿#include "io_service_group.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <thread>
+
+namespace bee {
+
+template <class T>
+struct IOServiceGroup::PinnedObject {
+  PinnedObject(std::shared_ptr<T> object, BucketPin&& pin)
+      : object(std::move(object)), pin(std::move(pin)) {}
+
+  std::shared_ptr<T> object;
+  BucketPin pin;
+};
+
+IOServiceGroup::IOServiceGroup(int32_t shard_count,
+                               std::shared_ptr<HttpEngine> http_engine)
+    : buckets_(new Bucket[kBucketCount]),
+      rebalancing_(false),
+      hot_shard_(-1),
+      hot_intervals_(0),
+      moved_buckets_(0) {
+  if (shard_count <= 0) {
+    shard_count = (std::max)(1u, std::thread::hardware_concurrency());
+  }
+  for (int32_t i = 0; i < shard_count; ++i) {
+    std::shared_ptr<IOService> shard = std::make_shared<IOService>(http_engine);
+    shard->SetTaskQueueBackend(TASK_QUEUE_BACKEND_MPSC);
+    shards_.push_back(shard);
+  }
+  for (int32_t i = 0; i < kBucketCount; ++i) {
+    buckets_[i].state.store(static_cast<uint64_t>(i % shard_count) << 32,
+                            std::memory_order_relaxed);
+  }
+}
+
+IOServiceGroup::~IOServiceGroup() {
+  Stop();
+}
+
+bool IOServiceGroup::Start(const ThreadOptions& options) {
+  rebalancing_ = (rebalance_policy_.interval > 0);
+  hot_shard_ = -1;
+  hot_intervals_ = 0;
+  moved_buckets_.store(0, std::memory_order_relaxed);
+  for (int32_t i = 0; i < kBucketCount; ++i) {
+    buckets_[i].load.store(0, std::memory_order_relaxed);
+  }
+
+  bool ret = true;
+  for (int32_t i = 0; i < ShardCount(); ++i) {
+    ThreadOptions shard_options = options;
+    if (!options.name.empty()) {
+      shard_options.name = options.name + std::to_string(i);
+    }
+    if (options.pin_each_thread && !options.cpus.empty()) {
+      shard_options.cpus.assign(1, options.cpus[i % options.cpus.size()]);
+    }
+    if (!shards_[i]->Start(1, shard_options)) {
+      ret = false;
+    }
+  }
+
+  if (ret && rebalancing_) {
+    ScheduleRebalance();
+  }
+  return ret;
+}
+
+bool IOServiceGroup::Stop() {
+  bool ret = true;
+  for (auto& shard : shards_) {
+    if (!shard->Stop()) {
+      ret = false;
+    }
+  }
+  return ret;
+}
+
+IOService* IOServiceGroup::ShardOf(uint64_t key) {
+  return shards_[CurrentShard(&buckets_[BucketOf(key)])].get();
+}
+
+std::shared_ptr<WebSocket> IOServiceGroup::CreateWebSocket(uint64_t key) {
+  return CreatePinned<WebSocket>(key, &IOService::CreateWebSocket);
+}
+
+std::shared_ptr<Timer> IOServiceGroup::CreateTimer(uint64_t key) {
+  return CreatePinned<Timer>(key, &IOService::CreateTimer);
+}
+
+template <class T>
+std::shared_ptr<T> IOServiceGroup::CreatePinned(
+    uint64_t key,
+    std::shared_ptr<T> (IOService::*create)()) {
+  Bucket* bucket = &buckets_[BucketOf(key)];
+  if (!rebalancing_) {
+    return (shards_[CurrentShard(bucket)].get()->*create)();
+  }
+
+  // The returned pointer shares ownership with the pin, so the bucket stays
+  // pinned until the caller releases the object.
+  int32_t shard = Pin(bucket);
+  BucketPin pin(bucket);
+  std::shared_ptr<T> object = (shards_[shard].get()->*create)();
+  if (object == nullptr) {
+    return nullptr;
+  }
+  T* raw = object.get();
+  std::shared_ptr<PinnedObject<T>> pinned =
+      std::make_shared<PinnedObject<T>>(std::move(object), std::move(pin));
+  return std::shared_ptr<T>(pinned, raw);
+}
+
+uint64_t IOServiceGroup::HashKey(const std::string& key) {
+  return static_cast<uint64_t>(std::hash<std::string>()(key));
+}
+
+uint64_t IOServiceGroup::MixKey(uint64_t key) {
+  // Finalizer of SplitMix64, so sequential ids spread over all buckets.
+  key ^= key >> 30;
+  key *= 0xbf58476d1ce4e5b9ULL;
+  key ^= key >> 27;
+  key *= 0x94d049bb133111ebULL;
+  key ^= key >> 31;
+  return key;
+}
+
+int32_t IOServiceGroup::BucketOf(uint64_t key) {
+  return static_cast<int32_t>(MixKey(key) % kBucketCount);
+}
+
+int64_t IOServiceGroup::NowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void IOServiceGroup::ScheduleRebalance() {
+  shards_[0]->PostDelayedTask(
+      [this] {
+        Rebalance();
+        ScheduleRebalance();
+      },
+      rebalance_policy_.interval);
+}
+
+void IOServiceGroup::Rebalance() {
+  const int32_t shard_count = ShardCount();
+  std::vector<int64_t> shard_loads(shard_count, 0);
+  std::vector<int64_t> bucket_loads(kBucketCount, 0);
+  int64_t total = 0;
+  for (int32_t i = 0; i < kBucketCount; ++i) {
+    bucket_loads[i] = buckets_[i].load.exchange(0, std::memory_order_relaxed);
+    shard_loads[CurrentShard(&buckets_[i])] += bucket_loads[i];
+    total += bucket_loads[i];
+  }
+  if (shard_count < 2 || total == 0) {
+    hot_intervals_ = 0;
+    return;
+  }
+
+  int32_t hot = static_cast<int32_t>(
+      std::max_element(shard_loads.begin(), shard_loads.end()) -
+      shard_loads.begin());
+  int32_t cold = static_cast<int32_t>(
+      std::min_element(shard_loads.begin(), shard_loads.end()) -
+      shard_loads.begin());
+  double average = static_cast<double>(total) / shard_count;
+  if (shard_loads[hot] <= average * (1.0 + rebalance_policy_.threshold)) {
+    hot_intervals_ = 0;
+    return;
+  }
+  if (hot != hot_shard_) {
+    hot_shard_ = hot;
+    hot_intervals_ = 0;
+  }
+  if (++hot_intervals_ < rebalance_policy_.persistence) {
+    return;
+  }
+  hot_intervals_ = 0;
+
+  // Move the heaviest buckets of the hot shard whose move narrows the gap to
+  // the cold shard, skipping pinned ones.
+  std::vector<int32_t> candidates;
+  for (int32_t i = 0; i < kBucketCount; ++i) {
+    if (CurrentShard(&buckets_[i]) == hot && bucket_loads[i] > 0) {
+      candidates.push_back(i);
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [&bucket_loads](int32_t a, int32_t b) {
+              return bucket_loads[a] > bucket_loads[b];
+            });
+  const uint64_t from = static_cast<uint64_t>(hot) << 32;
+  const uint64_t to = static_cast<uint64_t>(cold) << 32;
+  for (int32_t i : candidates) {
+    if (bucket_loads[i] * 2 > shard_loads[hot] - shard_loads[cold]) {
+      continue;
+    }
+    uint64_t expected = from;
+    if (buckets_[i].state.compare_exchange_strong(expected, to,
+                                                  std::memory_order_acq_rel)) {
+      shard_loads[hot] -= bucket_loads[i];
+      shard_loads[cold] += bucket_loads[i];
+      moved_buckets_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+}
+
+}  // namespace bee
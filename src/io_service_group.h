@@ -0,0 +1,216 @@
+﻿#ifndef BEE_IO_SERVICE_GROUP_H
+#define BEE_IO_SERVICE_GROUP_H
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "io_service.h"
+
+namespace bee {
+
+// Rebalancing of keys across the shards of an IOServiceGroup.
+struct ShardRebalancePolicy {
+  // Interval in milliseconds of measuring the load of shards, 0 disables
+  // rebalancing, which keeps the mapping of keys fixed and costs nothing.
+  int32_t interval = 0;
+  // A shard is overloaded when its run time of keyed tasks in an interval
+  // exceeds the average of all shards by this ratio.
+  double threshold = 0.25;
+  // Consecutive intervals the same shard must be overloaded before its keys
+  // are moved to the least loaded shard.
+  int32_t persistence = 3;
+};
+
+// Group of single threaded IOService shards with key affinity. Every key,
+// e.g. a session id, maps to one shard, so its tasks run in the order posted
+// from a thread and never concurrently, and its websockets and timers live
+// on the same thread, without any lock.
+// Keys are hashed into a fixed number of buckets, and buckets are spread
+// over the shards. With rebalancing, a bucket of an overloaded shard moves
+// to the least loaded shard, but only while none of its tasks is pending and
+// none of its websockets or timers is alive, so the guarantees above hold.
+// A single hot key can't be split.
+class IOServiceGroup {
+ public:
+  // Create |shard_count| shards, 0 for one per CPU. All shards share
+  // |http_engine|.
+  explicit IOServiceGroup(int32_t shard_count = 0,
+                          std::shared_ptr<HttpEngine> http_engine = nullptr);
+  ~IOServiceGroup();
+
+ public:
+  // Start every shard with one io_context thread. With |options.name| set,
+  // the thread of shard i is named "<name><i>-0", and with
+  // |options.pin_each_thread|, it's pinned to cpus[i % cpus.size()].
+  bool Start(const ThreadOptions& options = ThreadOptions());
+
+  // Stop all shards, tasks not run are discarded.
+  bool Stop();
+
+  // Set rebalancing of keys, takes effect on next Start(), disabled by
+  // default.
+  void SetRebalancePolicy(const ShardRebalancePolicy& policy) {
+    rebalance_policy_ = policy;
+  }
+
+  int32_t ShardCount() const { return static_cast<int32_t>(shards_.size()); }
+
+  // Return shard |index|, e.g. to configure it before Start(). Shards use
+  // TASK_QUEUE_BACKEND_MPSC by default, for they run a single thread.
+  IOService* Shard(int32_t index) { return shards_[index].get(); }
+
+  // Return the shard |key| maps to now. With rebalancing the key may move
+  // once it has no pending task and no io object, so use PostTask(key) and
+  // the io object factories below for anything that must stay in order.
+  IOService* ShardOf(uint64_t key);
+  IOService* ShardOf(const std::string& key) { return ShardOf(HashKey(key)); }
+
+  // Post a task |functor| to the shard of |key| and return immediately.
+  template <class FunctorT>
+  void PostTask(uint64_t key,
+                FunctorT&& functor,
+                TaskPriority priority = TASK_PRIORITY_NORMAL,
+                const Location& location = Location::Current()) {
+    Bucket* bucket = &buckets_[BucketOf(key)];
+    if (!rebalancing_) {
+      shards_[CurrentShard(bucket)]->PostTask(
+          std::forward<FunctorT>(functor), priority, location);
+      return;
+    }
+    int32_t shard = Pin(bucket);
+    shards_[shard]->PostTask(
+        KeyedTask<typename std::decay<FunctorT>::type>(
+            std::forward<FunctorT>(functor), BucketPin(bucket)),
+        priority, location);
+  }
+
+  template <class FunctorT>
+  void PostTask(const std::string& key,
+                FunctorT&& functor,
+                TaskPriority priority = TASK_PRIORITY_NORMAL,
+                const Location& location = Location::Current()) {
+    PostTask(HashKey(key), std::forward<FunctorT>(functor), priority,
+             location);
+  }
+
+  // Create a websocket or timer on the shard of |key|, nullptr if not
+  // running. The key keeps its shard while the object is alive.
+  std::shared_ptr<WebSocket> CreateWebSocket(uint64_t key);
+  std::shared_ptr<Timer> CreateTimer(uint64_t key);
+
+  std::shared_ptr<WebSocket> CreateWebSocket(const std::string& key) {
+    return CreateWebSocket(HashKey(key));
+  }
+  std::shared_ptr<Timer> CreateTimer(const std::string& key) {
+    return CreateTimer(HashKey(key));
+  }
+
+  // Return number of buckets of keys moved by rebalancing since Start().
+  int64_t MovedBuckets() const {
+    return moved_buckets_.load(std::memory_order_relaxed);
+  }
+
+  static uint64_t HashKey(const std::string& key);
+
+ private:
+  // Keys are mapped to buckets, which are the unit of rebalancing.
+  static const int32_t kBucketCount = 1024;
+
+  struct Bucket {
+    // Shard in high 32 bits and pins in low 32 bits, a pin is a pending task
+    // or a live io object. Pinning reads the shard in the same atomic add, so
+    // a bucket moves only by a compare-and-swap seeing no pin.
+    std::atomic<uint64_t> state{0};
+    // Run time in nanoseconds of tasks since last rebalancing.
+    std::atomic<int64_t> load{0};
+  };
+
+  // Unpin a bucket when a task is finished or discarded, movable only.
+  class BucketPin {
+   public:
+    explicit BucketPin(Bucket* bucket) : bucket_(bucket) {}
+    BucketPin(BucketPin&& other) : bucket_(other.bucket_) {
+      other.bucket_ = nullptr;
+    }
+    ~BucketPin() {
+      if (bucket_ != nullptr) {
+        bucket_->state.fetch_sub(1, std::memory_order_release);
+      }
+    }
+
+    Bucket* bucket() const { return bucket_; }
+
+   private:
+    BucketPin(const BucketPin&) = delete;
+    BucketPin& operator=(const BucketPin&) = delete;
+
+    Bucket* bucket_;
+  };
+
+  // Task of a key with rebalancing, measures its run time.
+  template <class FunctorT>
+  class KeyedTask {
+   public:
+    template <class F>
+    KeyedTask(F&& functor, BucketPin&& pin)
+        : functor_(std::forward<F>(functor)), pin_(std::move(pin)) {}
+    KeyedTask(KeyedTask&& other) = default;
+
+    void operator()() {
+      int64_t start = NowNanos();
+      functor_();
+      pin_.bucket()->load.fetch_add(NowNanos() - start,
+                                    std::memory_order_relaxed);
+    }
+
+   private:
+    FunctorT functor_;
+    BucketPin pin_;
+  };
+
+  template <class T>
+  struct PinnedObject;
+
+  IOServiceGroup(const IOServiceGroup&) = delete;
+  IOServiceGroup& operator=(const IOServiceGroup&) = delete;
+
+  static uint64_t MixKey(uint64_t key);
+  static int32_t BucketOf(uint64_t key);
+  static int64_t NowNanos();
+
+  static int32_t CurrentShard(const Bucket* bucket) {
+    return static_cast<int32_t>(
+        bucket->state.load(std::memory_order_relaxed) >> 32);
+  }
+
+  // Pin |bucket| and return its shard.
+  static int32_t Pin(Bucket* bucket) {
+    return static_cast<int32_t>(
+        bucket->state.fetch_add(1, std::memory_order_acquire) >> 32);
+  }
+
+  template <class T>
+  std::shared_ptr<T> CreatePinned(uint64_t key,
+                                  std::shared_ptr<T> (IOService::*create)());
+
+  // Measure loads of shards and move buckets, run on shard 0 periodically.
+  void Rebalance();
+  void ScheduleRebalance();
+
+  std::vector<std::shared_ptr<IOService>> shards_;
+  std::unique_ptr<Bucket[]> buckets_;
+  ShardRebalancePolicy rebalance_policy_;
+  bool rebalancing_;
+  // Shard overloaded in last intervals and for how many intervals.
+  int32_t hot_shard_;
+  int32_t hot_intervals_;
+  std::atomic<int64_t> moved_buckets_;
+};
+
+}  // namespace bee
+
+#endif  // BEE_IO_SERVICE_GROUP_H
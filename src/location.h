@@ -0,0 +1,46 @@
+﻿#ifndef BEE_LOCATION_H
+#define BEE_LOCATION_H
+
+#include <stdint.h>
+
+// Compilers with builtins for source location of the caller.
+#if defined(__GNUC__) || defined(__clang__) || \
+    (defined(_MSC_VER) && _MSC_VER >= 1926)
+#define BEE_HAS_BUILTIN_LOCATION 1
+#endif
+
+namespace bee {
+
+// Source location where a task is posted. Location::Current() as a default
+// argument captures the location of the caller for free, so that PostTask()
+// records its call site without any macro.
+class Location {
+ public:
+  Location() : file_(nullptr), line_(0) {}
+  Location(const char* file, int32_t line) : file_(file), line_(line) {}
+
+#if defined(BEE_HAS_BUILTIN_LOCATION)
+  static Location Current(const char* file = __builtin_FILE(),
+                          int32_t line = __builtin_LINE()) {
+    return Location(file, line);
+  }
+#else
+  static Location Current() { return Location(); }
+#endif
+
+  // Return file name, nullptr if unknown.
+  const char* File() const { return file_; }
+
+  int32_t Line() const { return line_; }
+
+ private:
+  const char* file_;
+  int32_t line_;
+};
+
+}  // namespace bee
+
+// Location of current line, for compilers without location builtins.
+#define BEE_FROM_HERE ::bee::Location(__FILE__, __LINE__)
+
+#endif  // BEE_LOCATION_H
@@ -0,0 +1,129 @@
+﻿#include "parallel_for.h"
+
+#include <atomic>
+
+#include "completion.h"
+
+namespace bee {
+
+namespace {
+
+// State of a ParallelForChunks() call shared by the caller and the helper
+// tasks. It's reference counted, for a helper task may run, or be discarded,
+// long after the call returned, and finds no chunk left then.
+class ParallelJob {
+ public:
+  ParallelJob(FunctionView<void(size_t)> functor,
+              size_t chunk_count,
+              int32_t refs)
+      : functor_(functor),
+        chunk_count_(chunk_count),
+        next_(0),
+        finished_(0),
+        refs_(refs) {}
+
+  static void* operator new(size_t size) {
+    return TaskNodePool::Allocate(size);
+  }
+
+  static void operator delete(void* p) { TaskNodePool::Free(p); }
+
+  // Run chunks until none is left to claim. |functor_| is called only for a
+  // claimed chunk, so it's never called after the caller returned.
+  void Work() {
+    size_t finished = 0;
+    for (;;) {
+      size_t chunk = next_.fetch_add(1, std::memory_order_relaxed);
+      if (chunk >= chunk_count_) {
+        break;
+      }
+      functor_(chunk);
+      ++finished;
+    }
+    if (finished > 0 &&
+        finished_.fetch_add(finished, std::memory_order_acq_rel) + finished ==
+            chunk_count_) {
+      completion_.Notify();
+    }
+  }
+
+  // Wait until all chunks are finished, call after Work().
+  void Wait() { completion_.Wait(); }
+
+  void Release() {
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      delete this;
+    }
+  }
+
+ private:
+  ~ParallelJob() {}
+
+  FunctionView<void(size_t)> functor_;
+  const size_t chunk_count_;
+  std::atomic<size_t> next_;
+  std::atomic<size_t> finished_;
+  std::atomic<int32_t> refs_;
+  Completion completion_;
+};
+
+// Helper task, releases its reference even if discarded.
+class ParallelHelper {
+ public:
+  explicit ParallelHelper(ParallelJob* job) : job_(job) {}
+  ParallelHelper(ParallelHelper&& other) : job_(other.job_) {
+    other.job_ = nullptr;
+  }
+  ~ParallelHelper() {
+    if (job_ != nullptr) {
+      job_->Release();
+    }
+  }
+
+  void operator()() { job_->Work(); }
+
+ private:
+  ParallelHelper(const ParallelHelper&) = delete;
+  ParallelHelper& operator=(const ParallelHelper&) = delete;
+
+  ParallelJob* job_;
+};
+
+}  // namespace
+
+void ParallelForChunks(IOService* io_service,
+                       size_t chunk_count,
+                       FunctionView<void(size_t)> functor) {
+  // One helper per io_context thread not occupied by the caller, no more
+  // than the chunks left to others.
+  size_t helpers = 0;
+  if (io_service != nullptr && io_service->Running()) {
+    int32_t threads = io_service->ThreadCount();
+    if (io_service->IsCurrent()) {
+      --threads;
+    }
+    if (threads > 0 && chunk_count > 1) {
+      helpers = (std::min)(static_cast<size_t>(threads), chunk_count - 1);
+    }
+  }
+  if (helpers == 0) {
+    for (size_t chunk = 0; chunk < chunk_count; ++chunk) {
+      functor(chunk);
+    }
+    return;
+  }
+
+  ParallelJob* job =
+      new ParallelJob(functor, chunk_count, static_cast<int32_t>(helpers) + 1);
+  TaskBatch batch;
+  for (size_t i = 0; i < helpers; ++i) {
+    batch.Add(ParallelHelper(job));
+  }
+  io_service->PostTasks(batch);
+
+  job->Work();
+  job->Wait();
+  job->Release();
+}
+
+}  // namespace bee
@@ -0,0 +1,91 @@
+﻿#ifndef BEE_PARALLEL_FOR_H
+#define BEE_PARALLEL_FOR_H
+
+#include <stddef.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "function_view.h"
+#include "io_service.h"
+
+namespace bee {
+
+// Call |functor| with every chunk index in [0, |chunk_count|) once, on the
+// threads of |io_service| and the calling thread, and return when all chunks
+// are finished. Chunks are claimed one by one from a shared counter, so a
+// fast thread takes more chunks.
+// The caller runs chunks too instead of blocking, so it may be a thread of
+// |io_service| itself, even of a single threaded one, and helper tasks
+// queued behind other tasks never hold it up: it waits only for chunks
+// already running on other threads. If |io_service| is not running, all
+// chunks run on the caller. |functor| must not throw.
+void ParallelForChunks(IOService* io_service,
+                       size_t chunk_count,
+                       FunctionView<void(size_t)> functor);
+
+// Call |functor| with consecutive sub ranges [begin, end) of [|begin|,
+// |end|) of at most |grain| indexes, in parallel as ParallelForChunks().
+// |grain| should be large enough for a chunk to outweigh a task post, e.g.
+//   ParallelFor(&io_service, 0, peers.size(), 16,
+//               [&](size_t begin, size_t end) {
+//                 for (size_t i = begin; i < end; ++i) {
+//                   peers[i]->Send(message);
+//                 }
+//               });
+template <class FunctorT>
+void ParallelFor(IOService* io_service,
+                 size_t begin,
+                 size_t end,
+                 size_t grain,
+                 FunctorT&& functor) {
+  if (end <= begin) {
+    return;
+  }
+  grain = (std::max)(grain, static_cast<size_t>(1));
+  size_t chunk_count = (end - begin + grain - 1) / grain;
+  ParallelForChunks(
+      io_service, chunk_count, [begin, end, grain, &functor](size_t chunk) {
+        size_t chunk_begin = begin + chunk * grain;
+        functor(chunk_begin, (std::min)(end, chunk_begin + grain));
+      });
+}
+
+// Reduce [|begin|, |end|) in parallel as ParallelFor(): |map| returns the
+// result of a sub range [begin, end) as T, and |combine| folds two results.
+// Results of chunks are folded from left to right on the caller, starting
+// with |identity|, so |combine| only needs to be associative, and floating
+// point results are the same on every run, e.g.
+//   uint32_t sum = ParallelReduce(&io_service, 0, size, 65536, 0u,
+//       [&](size_t begin, size_t end) { return Checksum(data, begin, end); },
+//       [](uint32_t a, uint32_t b) { return a + b; });
+template <class T, class MapT, class CombineT>
+T ParallelReduce(IOService* io_service,
+                 size_t begin,
+                 size_t end,
+                 size_t grain,
+                 T identity,
+                 MapT&& map,
+                 CombineT&& combine) {
+  if (end <= begin) {
+    return identity;
+  }
+  grain = (std::max)(grain, static_cast<size_t>(1));
+  size_t chunk_count = (end - begin + grain - 1) / grain;
+  std::vector<T> results(chunk_count, identity);
+  ParallelForChunks(
+      io_service, chunk_count,
+      [begin, end, grain, &map, &results](size_t chunk) {
+        size_t chunk_begin = begin + chunk * grain;
+        results[chunk] = map(chunk_begin, (std::min)(end, chunk_begin + grain));
+      });
+  T result = std::move(identity);
+  for (T& chunk_result : results) {
+    result = combine(std::move(result), std::move(chunk_result));
+  }
+  return result;
+}
+
+}  // namespace bee
+
+#endif  // BEE_PARALLEL_FOR_H
@@ -0,0 +1,322 @@
+﻿#include "platform_thread.h"
+
+#include <stdio.h>
+
+#if defined(_WIN32)
+#include <process.h>
+#include <windows.h>
+#else
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace bee {
+
+namespace {
+
+#if defined(__linux__)
+// Max length of a thread name on Linux, excluding the terminator.
+const size_t kMaxThreadNameLength = 15;
+#endif
+
+// Name of a thread parked in ThreadCache.
+const char kIdleThreadName[] = "bee-idle";
+
+std::string ThreadName(const ThreadOptions& options, int32_t index) {
+  if (options.name.empty()) {
+    return std::string();
+  }
+  std::string suffix = "-" + std::to_string(index);
+#if defined(__linux__)
+  // Truncate the name but keep the index.
+  if (options.name.size() + suffix.size() > kMaxThreadNameLength) {
+    return options.name.substr(0, kMaxThreadNameLength - suffix.size()) +
+           suffix;
+  }
+#endif
+  return options.name + suffix;
+}
+
+#if defined(_WIN32)
+typedef HRESULT(WINAPI* SetThreadDescriptionFunction)(HANDLE, PCWSTR);
+
+void SetCurrentThreadName(const std::string& name) {
+  // SetThreadDescription() is only available since Windows 10 1607.
+  static SetThreadDescriptionFunction set_thread_description =
+      reinterpret_cast<SetThreadDescriptionFunction>(::GetProcAddress(
+          ::GetModuleHandleW(L"Kernel32.dll"), "SetThreadDescription"));
+  if (set_thread_description != nullptr) {
+    std::wstring wide_name(name.begin(), name.end());
+    set_thread_description(::GetCurrentThread(), wide_name.c_str());
+  }
+}
+
+void SetCurrentThreadAffinity(const std::vector<int32_t>& cpus) {
+  DWORD_PTR mask = 0;
+  for (int32_t cpu : cpus) {
+    if (cpu >= 0 && cpu < static_cast<int32_t>(sizeof(mask) * 8)) {
+      mask |= static_cast<DWORD_PTR>(1) << cpu;
+    }
+  }
+  if (mask == 0 || ::SetThreadAffinityMask(::GetCurrentThread(), mask) == 0) {
+    printf("Set thread affinity failed %lu\n", ::GetLastError());
+  }
+}
+
+bool ResetCurrentThreadAffinity() {
+  DWORD_PTR process_mask = 0;
+  DWORD_PTR system_mask = 0;
+  if (!::GetProcessAffinityMask(::GetCurrentProcess(), &process_mask,
+                                &system_mask) ||
+      ::SetThreadAffinityMask(::GetCurrentThread(), process_mask) == 0) {
+    printf("Reset thread affinity failed %lu\n", ::GetLastError());
+    return false;
+  }
+  return true;
+}
+
+bool ResetCurrentThreadSched() {
+  if (!::SetThreadPriority(::GetCurrentThread(), THREAD_PRIORITY_NORMAL)) {
+    printf("Reset thread priority failed %lu\n", ::GetLastError());
+    return false;
+  }
+  return true;
+}
+
+void SetCurrentThreadSched(ThreadSchedPolicy policy, int32_t priority) {
+  int32_t thread_priority = THREAD_PRIORITY_NORMAL;
+  if (policy == THREAD_SCHED_POLICY_FIFO) {
+    thread_priority = THREAD_PRIORITY_TIME_CRITICAL;
+  } else if (priority < 0) {
+    thread_priority = THREAD_PRIORITY_ABOVE_NORMAL;
+  } else if (priority > 0) {
+    thread_priority = THREAD_PRIORITY_BELOW_NORMAL;
+  } else {
+    return;
+  }
+  if (!::SetThreadPriority(::GetCurrentThread(), thread_priority)) {
+    printf("Set thread priority failed %lu\n", ::GetLastError());
+  }
+}
+#else
+void SetCurrentThreadName(const std::string& name) {
+#if defined(__APPLE__)
+  pthread_setname_np(name.c_str());
+#elif defined(__linux__)
+  pthread_setname_np(pthread_self(), name.c_str());
+#endif
+}
+
+void SetCurrentThreadAffinity(const std::vector<int32_t>& cpus) {
+#if defined(__linux__)
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (int32_t cpu : cpus) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &cpu_set);
+    }
+  }
+  int32_t error =
+      pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+  if (error != 0) {
+    printf("Set thread affinity failed %s\n", strerror(error));
+  }
+#else
+  // No thread affinity API on macOS.
+  (void)cpus;
+#endif
+}
+
+bool ResetCurrentThreadAffinity() {
+#if defined(__linux__)
+  // Affinity of the main thread, which new threads inherit by default.
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  if (sched_getaffinity(getpid(), sizeof(cpu_set), &cpu_set) != 0) {
+    printf("Get process affinity failed %s\n", strerror(errno));
+    return false;
+  }
+  int32_t error =
+      pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+  if (error != 0) {
+    printf("Reset thread affinity failed %s\n", strerror(error));
+    return false;
+  }
+#endif
+  return true;
+}
+
+bool ResetCurrentThreadSched() {
+  sched_param param;
+  memset(&param, 0, sizeof(param));
+  int32_t error = pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+  if (error != 0) {
+    printf("Reset thread policy failed %s\n", strerror(error));
+    return false;
+  }
+#if defined(__linux__)
+  // Lowering the nice value needs CAP_SYS_NICE or RLIMIT_NICE.
+  if (setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 0) !=
+      0) {
+    printf("Reset nice failed %s\n", strerror(errno));
+    return false;
+  }
+#endif
+  return true;
+}
+
+void SetCurrentThreadSched(ThreadSchedPolicy policy, int32_t priority) {
+  if (policy == THREAD_SCHED_POLICY_FIFO) {
+    sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+    int32_t error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (error != 0) {
+      printf("Set SCHED_FIFO priority %d failed %s\n", priority,
+             strerror(error));
+    }
+  } else if (priority != 0) {
+#if defined(__linux__)
+    // Nice value is per thread on Linux.
+    if (setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)),
+                    priority) != 0) {
+      printf("Set nice %d failed %s\n", priority, strerror(errno));
+    }
+#endif
+  }
+}
+#endif
+
+}  // namespace
+
+std::unique_ptr<PlatformThread> PlatformThread::Create(
+    std::function<void()> function,
+    size_t stack_size) {
+  std::unique_ptr<PlatformThread> thread(new PlatformThread);
+  std::function<void()>* param = new std::function<void()>(std::move(function));
+#if defined(_WIN32)
+  uintptr_t handle = _beginthreadex(
+      nullptr, static_cast<unsigned>(stack_size), &PlatformThread::ThreadMain,
+      param, STACK_SIZE_PARAM_IS_A_RESERVATION,
+      &thread->id_);
+  if (handle == 0) {
+    delete param;
+    return nullptr;
+  }
+  thread->handle_ = reinterpret_cast<void*>(handle);
+#else
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  if (stack_size > 0) {
+    int32_t error = pthread_attr_setstacksize(&attr, stack_size);
+    if (error != 0) {
+      printf("Set stack size %zu failed %s\n", stack_size, strerror(error));
+    }
+  }
+  int32_t error = pthread_create(&thread->thread_, &attr,
+                                 &PlatformThread::ThreadMain, param);
+  pthread_attr_destroy(&attr);
+  if (error != 0) {
+    delete param;
+    return nullptr;
+  }
+  thread->joinable_ = true;
+#endif
+  return thread;
+}
+
+void PlatformThread::ApplyOptions(const ThreadOptions& options, int32_t index) {
+  std::string name = ThreadName(options, index);
+  if (!name.empty()) {
+    SetCurrentThreadName(name);
+  }
+
+  if (!options.cpus.empty()) {
+    if (options.pin_each_thread) {
+      std::vector<int32_t> cpus(
+          1, options.cpus[index % static_cast<int32_t>(options.cpus.size())]);
+      SetCurrentThreadAffinity(cpus);
+    } else {
+      SetCurrentThreadAffinity(options.cpus);
+    }
+  }
+
+  SetCurrentThreadSched(options.sched_policy, options.priority);
+}
+
+bool PlatformThread::ResetOptions(const ThreadOptions& options) {
+  bool ret = true;
+  if (!options.name.empty()) {
+    SetCurrentThreadName(kIdleThreadName);
+  }
+
+  if (!options.cpus.empty() && !ResetCurrentThreadAffinity()) {
+    ret = false;
+  }
+
+  if ((options.sched_policy != THREAD_SCHED_POLICY_NORMAL ||
+       options.priority != 0) &&
+      !ResetCurrentThreadSched()) {
+    ret = false;
+  }
+  return ret;
+}
+
+PlatformThread::~PlatformThread() {
+  // Never leak a running thread as joinable.
+  Detach();
+}
+
+void PlatformThread::Join() {
+#if defined(_WIN32)
+  if (handle_ != nullptr) {
+    ::WaitForSingleObject(handle_, INFINITE);
+    ::CloseHandle(handle_);
+    handle_ = nullptr;
+  }
+#else
+  if (joinable_) {
+    pthread_join(thread_, nullptr);
+    joinable_ = false;
+  }
+#endif
+}
+
+void PlatformThread::Detach() {
+#if defined(_WIN32)
+  if (handle_ != nullptr) {
+    ::CloseHandle(handle_);
+    handle_ = nullptr;
+  }
+#else
+  if (joinable_) {
+    pthread_detach(thread_);
+    joinable_ = false;
+  }
+#endif
+}
+
+bool PlatformThread::IsCurrent() const {
+#if defined(_WIN32)
+  return id_ == ::GetCurrentThreadId();
+#else
+  return joinable_ && pthread_equal(thread_, pthread_self());
+#endif
+}
+
+#if defined(_WIN32)
+unsigned __stdcall PlatformThread::ThreadMain(void* param) {
+#else
+void* PlatformThread::ThreadMain(void* param) {
+#endif
+  std::unique_ptr<std::function<void()>> function(
+      static_cast<std::function<void()>*>(param));
+  (*function)();
+  return 0;
+}
+
+}  // namespace bee
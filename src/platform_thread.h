@@ -0,0 +1,97 @@
+﻿#ifndef BEE_PLATFORM_THREAD_H
+#define BEE_PLATFORM_THREAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
+
+namespace bee {
+
+enum ThreadSchedPolicy {
+  // Default time sharing policy, |priority| is the nice value.
+  THREAD_SCHED_POLICY_NORMAL,
+  // Real time FIFO policy, |priority| is the real time priority, which
+  // requires CAP_SYS_NICE on Linux.
+  THREAD_SCHED_POLICY_FIFO
+};
+
+// Options of io_context threads of IOService.
+struct ThreadOptions {
+  // CPUs the threads may run on, empty for no affinity.
+  std::vector<int32_t> cpus;
+
+  // Pin thread i to cpus[i % cpus.size()] only instead of all |cpus|, which
+  // keeps every thread on its own core.
+  bool pin_each_thread = false;
+
+  // Thread i is named "<name>-<i>", with <name> truncated to fit 15
+  // characters on Linux, empty to keep the name unchanged.
+  std::string name;
+
+  ThreadSchedPolicy sched_policy = THREAD_SCHED_POLICY_NORMAL;
+
+  // Nice value for THREAD_SCHED_POLICY_NORMAL, 0 to keep it unchanged, or
+  // real time priority for THREAD_SCHED_POLICY_FIFO.
+  int32_t priority = 0;
+
+  // Stack size in bytes, 0 for default.
+  size_t stack_size = 0;
+};
+
+// Thread with configurable stack size, which std::thread lacks.
+class PlatformThread {
+ public:
+  // Run |function| on a new thread with a stack of |stack_size| bytes, 0 for
+  // default, return nullptr if failed.
+  static std::unique_ptr<PlatformThread> Create(std::function<void()> function,
+                                                size_t stack_size);
+
+  // Apply affinity, name and scheduling of |options| to the current thread,
+  // which is thread |index| of its pool. Stack size is applied on Create().
+  // Failures are logged and ignored.
+  static void ApplyOptions(const ThreadOptions& options, int32_t index);
+
+  // Undo ApplyOptions() of |options| on the current thread before it's
+  // reused, restoring affinity of the process and default scheduling.
+  // Return false if they can't be restored, e.g. an unprivileged thread
+  // can't lower its nice value back, then the thread shouldn't be reused.
+  static bool ResetOptions(const ThreadOptions& options);
+
+  ~PlatformThread();
+
+  void Join();
+
+  void Detach();
+
+  // Return if called from the thread.
+  bool IsCurrent() const;
+
+ private:
+  PlatformThread() = default;
+  PlatformThread(const PlatformThread&) = delete;
+  PlatformThread& operator=(const PlatformThread&) = delete;
+
+#if defined(_WIN32)
+  static unsigned __stdcall ThreadMain(void* param);
+
+  // HANDLE and thread id, windows.h is not included here.
+  void* handle_ = nullptr;
+  unsigned id_ = 0;
+#else
+  static void* ThreadMain(void* param);
+
+  pthread_t thread_;
+  bool joinable_ = false;
+#endif
+};
+
+}  // namespace bee
+
+#endif  // BEE_PLATFORM_THREAD_H
@@ -0,0 +1,209 @@
+﻿#include "sequenced_task_runner.h"
+
+namespace bee {
+
+// Drain task posted to IOService, keeps the runner alive until executed or
+// discarded.
+class SequencedTaskRunner::DrainTask : public FunctorWrapper {
+ public:
+  DrainTask(std::shared_ptr<SequencedTaskRunner> runner,
+            const Location& location)
+      : FunctorWrapper(location), runner_(runner) {}
+
+  void run() override { runner_->Drain(); }
+
+  void discard() override {
+    runner_->Discard();
+    delete this;
+  }
+
+ private:
+  ~DrainTask() override {}
+
+  std::shared_ptr<SequencedTaskRunner> runner_;
+};
+
+thread_local SequencedTaskRunner* SequencedTaskRunner::current_ = nullptr;
+
+std::shared_ptr<SequencedTaskRunner> SequencedTaskRunner::Create(
+    IOService* io_service,
+    TaskPriority priority) {
+  return std::shared_ptr<SequencedTaskRunner>(
+      new SequencedTaskRunner(io_service, priority));
+}
+
+SequencedTaskRunner::SequencedTaskRunner(IOService* io_service,
+                                         TaskPriority priority)
+    : io_service_(io_service),
+      priority_(priority),
+      head_(nullptr),
+      tail_(nullptr),
+      scheduled_(false),
+      running_(false) {}
+
+SequencedTaskRunner::~SequencedTaskRunner() {
+  // No drain task is alive, or it would have kept us alive.
+  while (head_ != nullptr) {
+    FunctorWrapper* next = head_->next_;
+    head_->discard();
+    head_ = next;
+  }
+}
+
+bool SequencedTaskRunner::IsCurrent() {
+  return current_ == this;
+}
+
+void SequencedTaskRunner::PostInternal(FunctorWrapper* functor_wrapper) {
+  bool schedule = false;
+  Location location = functor_wrapper->location_;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    functor_wrapper->next_ = nullptr;
+    if (tail_ != nullptr) {
+      tail_->next_ = functor_wrapper;
+    } else {
+      head_ = functor_wrapper;
+    }
+    tail_ = functor_wrapper;
+    if (!scheduled_ && !running_) {
+      scheduled_ = true;
+      schedule = true;
+    }
+  }
+
+  if (schedule) {
+    Schedule(location);
+  }
+}
+
+void SequencedTaskRunner::InvokeInternal(FunctionView<void()> functor,
+                                         const Location& location) {
+  if (IsCurrent()) {
+    functor();
+    return;
+  }
+
+  // On a thread of the pool, take over the sequence unless it's executing,
+  // run the tasks pending now and then |functor| here in order. Waiting for the
+  // drain task instead may wait for this very thread.
+  if (io_service_->IsCurrent()) {
+    bool acquired = false;
+    bool nested = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!running_) {
+        running_ = true;
+        owner_ = std::this_thread::get_id();
+        acquired = true;
+      } else if (owner_ == std::this_thread::get_id()) {
+        nested = true;
+      }
+    }
+
+    if (acquired || nested) {
+      SequencedTaskRunner* previous = current_;
+      current_ = this;
+      // A nested call comes from a task of the runner up the stack through
+      // another runner, run it directly like IsCurrent().
+      if (acquired) {
+        ExecutePending();
+      }
+      functor();
+      current_ = previous;
+      if (acquired) {
+        Release();
+      }
+      return;
+    }
+  }
+
+  // The invoker stays on stack, the runner either executes or discards it,
+  // both wake us up.
+  FunctorInvoker functor_wrapper(functor, location);
+  PostInternal(&functor_wrapper);
+  functor_wrapper.wait();
+}
+
+void SequencedTaskRunner::Schedule(const Location& location) {
+  io_service_->PostInternal(new DrainTask(shared_from_this(), location),
+                            priority_);
+}
+
+void SequencedTaskRunner::Drain() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    scheduled_ = false;
+    // Taken over by an invoke, which schedules again when done.
+    if (running_) {
+      return;
+    }
+    running_ = true;
+    owner_ = std::this_thread::get_id();
+  }
+
+  // Tasks posted meanwhile wait for next turn.
+  SequencedTaskRunner* previous = current_;
+  current_ = this;
+  ExecutePending();
+  current_ = previous;
+  Release();
+}
+
+bool SequencedTaskRunner::ExecutePending() {
+  FunctorWrapper* task = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    task = head_;
+    head_ = nullptr;
+    tail_ = nullptr;
+  }
+  if (task == nullptr) {
+    return false;
+  }
+
+  while (task != nullptr) {
+    FunctorWrapper* next = task->next_;
+    task->execute();
+    task = next;
+  }
+  return true;
+}
+
+void SequencedTaskRunner::Release() {
+  Location location;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_ = false;
+    owner_ = std::thread::id();
+    if (head_ == nullptr || scheduled_) {
+      return;
+    }
+    scheduled_ = true;
+    location = head_->location_;
+  }
+  Schedule(location);
+}
+
+void SequencedTaskRunner::Discard() {
+  FunctorWrapper* task = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    scheduled_ = false;
+    // The owner schedules again when done, and the tasks are discarded then.
+    if (running_) {
+      return;
+    }
+    task = head_;
+    head_ = nullptr;
+    tail_ = nullptr;
+  }
+
+  while (task != nullptr) {
+    FunctorWrapper* next = task->next_;
+    task->discard();
+    task = next;
+  }
+}
+
+}  // namespace bee
@@ -0,0 +1,127 @@
+﻿#ifndef BEE_SEQUENCED_TASK_RUNNER_H
+#define BEE_SEQUENCED_TASK_RUNNER_H
+
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+#include "io_service.h"
+
+namespace bee {
+
+// Strand-like runner which executes its own tasks in FIFO order and never
+// concurrently, on the threads of a shared IOService. So hundreds of
+// components needing ordering may share a small pool instead of owning a
+// thread each. It has the same PostTask()/Invoke()/IsCurrent() API as
+// IOService, to replace an IOService one-for-one.
+// Pending tasks are drained by one task posted to the IOService, which is
+// posted again if more tasks arrive meanwhile, so every runner gets a fair
+// turn of the pool. The runner must be deleted before the IOService, and
+// tasks posted after the IOService stopped are dropped, just like IOService.
+class SequencedTaskRunner
+    : public std::enable_shared_from_this<SequencedTaskRunner> {
+ public:
+  // Create a runner of tasks on |io_service| with |priority|.
+  static std::shared_ptr<SequencedTaskRunner> Create(
+      IOService* io_service,
+      TaskPriority priority = TASK_PRIORITY_NORMAL);
+  ~SequencedTaskRunner();
+
+ public:
+  // Sync call a method |functor| with a return value, the |functor| will be
+  // executed in order with other tasks of the runner, or directly if called
+  // from the runner. On a thread of the pool, the caller takes over the
+  // sequence and runs the pending tasks and then |functor| itself, instead
+  // of waiting for a pool thread, so it never waits forever on a single
+  // threaded pool or between runners invoking each other. It still waits if
+  // the runner is executing on another thread.
+  template <
+      class ReturnT,
+      typename = typename std::enable_if<!std::is_void<ReturnT>::value>::type>
+  ReturnT Invoke(FunctionView<ReturnT()> functor,
+                 const Location& location = Location::Current()) {
+    ReturnT result;
+    InvokeInternal([functor, &result] { result = functor(); }, location);
+    return result;
+  }
+
+  // Sync call a method |functor| without return value, see above.
+  template <
+      class ReturnT,
+      typename = typename std::enable_if<std::is_void<ReturnT>::value>::type>
+  void Invoke(FunctionView<void()> functor,
+              const Location& location = Location::Current()) {
+    InvokeInternal(functor, location);
+  }
+
+  // Post a task |functor| to the runner and return immediately.
+  template <class FunctorT>
+  void PostTask(FunctorT&& functor,
+                const Location& location = Location::Current()) {
+    PostInternal(
+        new FunctorPost<FunctorT>(std::forward<FunctorT>(functor), location));
+  }
+
+  // Same as PostTask(), and return a handle to cancel the task.
+  template <class FunctorT>
+  TaskHandle PostCancelableTask(
+      FunctorT&& functor,
+      const Location& location = Location::Current()) {
+    CancelableFunctorWrapper* functor_wrapper =
+        new CancelableFunctorPost<FunctorT>(std::forward<FunctorT>(functor),
+                                            location);
+    TaskHandle handle(functor_wrapper);
+    PostInternal(functor_wrapper);
+    return handle;
+  }
+
+  // Return if called from a task of the runner.
+  bool IsCurrent();
+
+ private:
+  class DrainTask;
+
+  SequencedTaskRunner(IOService* io_service, TaskPriority priority);
+  SequencedTaskRunner(const SequencedTaskRunner&) = delete;
+  SequencedTaskRunner& operator=(const SequencedTaskRunner&) = delete;
+
+  void PostInternal(FunctorWrapper* functor_wrapper);
+  void InvokeInternal(FunctionView<void()> functor, const Location& location);
+
+  // Post a drain task to IOService.
+  void Schedule(const Location& location);
+
+  // Execute tasks pending now, called by drain task.
+  void Drain();
+
+  // Execute tasks pending now on the owner thread, return false if none.
+  bool ExecutePending();
+
+  // Give up the sequence after executing, schedule a drain task if more
+  // tasks arrived meanwhile.
+  void Release();
+
+  // Discard all pending tasks, called if drain task is discarded.
+  void Discard();
+
+  IOService* io_service_;
+  TaskPriority priority_;
+
+  std::mutex mutex_;
+  // Pending tasks linked intrusively.
+  FunctorWrapper* head_;
+  FunctorWrapper* tail_;
+  // Whether a drain task is posted and not started, which owns the runner.
+  bool scheduled_;
+  // Whether tasks are executing, by a drain task or an invoke taking over
+  // the sequence on |owner_| thread.
+  bool running_;
+  std::thread::id owner_;
+
+  static thread_local SequencedTaskRunner* current_;
+};
+
+}  // namespace bee
+
+#endif  // BEE_SEQUENCED_TASK_RUNNER_H
@@ -0,0 +1,72 @@
+﻿#include "task_handle.h"
+
+#include "io_service.h"
+#include "timing_wheel.h"
+
+namespace bee {
+
+TaskHandle::TaskHandle(CancelableFunctorWrapper* task)
+    : task_(task), index_(0), generation_(0) {
+  task_->add_ref();
+}
+
+TaskHandle::TaskHandle(const TaskHandle& other)
+    : wheel_(other.wheel_),
+      task_(other.task_),
+      index_(other.index_),
+      generation_(other.generation_) {
+  if (task_ != nullptr) {
+    task_->add_ref();
+  }
+}
+
+TaskHandle::TaskHandle(TaskHandle&& other)
+    : wheel_(std::move(other.wheel_)),
+      task_(other.task_),
+      index_(other.index_),
+      generation_(other.generation_) {
+  other.task_ = nullptr;
+}
+
+TaskHandle::~TaskHandle() {
+  Reset();
+}
+
+TaskHandle& TaskHandle::operator=(const TaskHandle& other) {
+  if (this != &other) {
+    TaskHandle copy(other);
+    *this = std::move(copy);
+  }
+  return *this;
+}
+
+TaskHandle& TaskHandle::operator=(TaskHandle&& other) {
+  if (this != &other) {
+    Reset();
+    wheel_ = std::move(other.wheel_);
+    task_ = other.task_;
+    index_ = other.index_;
+    generation_ = other.generation_;
+    other.task_ = nullptr;
+  }
+  return *this;
+}
+
+bool TaskHandle::Cancel() {
+  // Remove a delayed task from the wheel if it's still there, otherwise it
+  // has been fired to the queues, or deleted with the wheel.
+  std::shared_ptr<TimingWheel> wheel = wheel_.lock();
+  if (wheel != nullptr && wheel->Cancel(index_, generation_)) {
+    return true;
+  }
+  return task_ != nullptr && task_->cancel();
+}
+
+void TaskHandle::Reset() {
+  if (task_ != nullptr) {
+    task_->release();
+    task_ = nullptr;
+  }
+}
+
+}  // namespace bee
@@ -0,0 +1,60 @@
+﻿#ifndef BEE_TASK_HANDLE_H
+#define BEE_TASK_HANDLE_H
+
+#include <stdint.h>
+#include <memory>
+
+namespace bee {
+
+class CancelableFunctorWrapper;
+class TimingWheel;
+
+// Handle of a cancellable task, cheap to copy. The handle may outlive the
+// task and the IOService, Cancel() just fails then.
+// A delayed task is removed from the timing wheel on Cancel(). A task posted
+// to run now, or a delayed task already fired, can't be unlinked from the
+// lock free queues, so Cancel() marks it dead and releases its functor at
+// once, and the loop skips the empty node later.
+class TaskHandle {
+ public:
+  TaskHandle() : task_(nullptr), index_(0), generation_(0) {}
+  TaskHandle(const TaskHandle& other);
+  TaskHandle(TaskHandle&& other);
+  ~TaskHandle();
+
+  TaskHandle& operator=(const TaskHandle& other);
+  TaskHandle& operator=(TaskHandle&& other);
+
+  // Cancel the task if it is still pending, the task is released at once
+  // without running. Return true if the task is cancelled, false if it has
+  // been started, finished or cancelled already.
+  bool Cancel();
+
+ private:
+  friend class IOService;
+  friend class SequencedTaskRunner;
+  friend class TimingWheel;
+
+  // Take a reference of |task|.
+  explicit TaskHandle(CancelableFunctorWrapper* task);
+
+  // Bind to entry |index| of |wheel| while the task waits there.
+  void BindWheel(std::weak_ptr<TimingWheel> wheel,
+                 uint32_t index,
+                 uint32_t generation) {
+    wheel_ = std::move(wheel);
+    index_ = index;
+    generation_ = generation;
+  }
+
+  void Reset();
+
+  std::weak_ptr<TimingWheel> wheel_;
+  CancelableFunctorWrapper* task_;
+  uint32_t index_;
+  uint32_t generation_;
+};
+
+}  // namespace bee
+
+#endif  // BEE_TASK_HANDLE_H
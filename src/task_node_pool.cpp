@@ -0,0 +1,199 @@
+﻿#include "task_node_pool.h"
+
+#include <mutex>
+#include <vector>
+
+namespace bee {
+
+namespace {
+
+// Block sizes including header, a request is served by the smallest fit.
+// The largest class holds composed operations of beast websocket writes.
+const size_t kBlockSizes[] = {64, 128, 256, 512, 1024, 2048};
+const int32_t kSizeClassCount = sizeof(kBlockSizes) / sizeof(kBlockSizes[0]);
+
+// Header before every block, keeps payload aligned like operator new.
+const size_t kHeaderSize = 16;
+
+// Max free blocks and bytes kept in one local free list, the rest go back
+// to heap.
+const size_t kMaxCachedBlocks = 4096;
+const size_t kMaxCachedBytes = 1024 * 1024;
+
+class TaskNodeCache;
+
+struct BlockHeader {
+  // Owner cache, nullptr for blocks not cached.
+  TaskNodeCache* cache;
+  int32_t size_class;
+};
+
+static_assert(sizeof(BlockHeader) <= kHeaderSize, "Header too large");
+
+// Free blocks are linked through their payload.
+BlockHeader*& NextOf(BlockHeader* header) {
+  return *reinterpret_cast<BlockHeader**>(reinterpret_cast<char*>(header) +
+                                          kHeaderSize);
+}
+
+int32_t SizeClassOf(size_t total_size) {
+  for (int32_t i = 0; i < kSizeClassCount; ++i) {
+    if (total_size <= kBlockSizes[i]) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+class TaskNodeCache {
+ public:
+  TaskNodeCache() {
+    for (int32_t i = 0; i < kSizeClassCount; ++i) {
+      local_[i] = nullptr;
+      local_count_[i] = 0;
+      remote_[i] = nullptr;
+    }
+  }
+
+  // Owner thread only.
+  BlockHeader* Pop(int32_t size_class) {
+    if (local_[size_class] == nullptr) {
+      TakeRemote(size_class);
+    }
+    BlockHeader* header = local_[size_class];
+    if (header != nullptr) {
+      local_[size_class] = NextOf(header);
+      --local_count_[size_class];
+    }
+    return header;
+  }
+
+  // Owner thread only.
+  void PushLocal(BlockHeader* header) {
+    int32_t size_class = header->size_class;
+    if (local_count_[size_class] >= kMaxCachedBlocks ||
+        local_count_[size_class] * kBlockSizes[size_class] >=
+            kMaxCachedBytes) {
+      ::operator delete(header);
+      return;
+    }
+    NextOf(header) = local_[size_class];
+    local_[size_class] = header;
+    ++local_count_[size_class];
+  }
+
+  // Any thread.
+  void PushRemote(BlockHeader* header) {
+    std::atomic<BlockHeader*>& remote = remote_[header->size_class];
+    BlockHeader* head = remote.load(std::memory_order_relaxed);
+    do {
+      NextOf(header) = head;
+    } while (!remote.compare_exchange_weak(head, header,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed));
+  }
+
+ private:
+  // Only the owner takes from remote list and it takes the list as a whole,
+  // so the lock free list is free of ABA problem.
+  void TakeRemote(int32_t size_class) {
+    BlockHeader* header =
+        remote_[size_class].exchange(nullptr, std::memory_order_acquire);
+    while (header != nullptr) {
+      BlockHeader* next = NextOf(header);
+      PushLocal(header);
+      header = next;
+    }
+  }
+
+  BlockHeader* local_[kSizeClassCount];
+  size_t local_count_[kSizeClassCount];
+  std::atomic<BlockHeader*> remote_[kSizeClassCount];
+};
+
+// Caches of exited threads are never deleted, for their blocks may still be
+// in flight, they are adopted by new threads instead.
+std::mutex& AbandonedMutex() {
+  static std::mutex* mutex = new std::mutex;
+  return *mutex;
+}
+
+std::vector<TaskNodeCache*>& AbandonedCaches() {
+  static std::vector<TaskNodeCache*>* caches = new std::vector<TaskNodeCache*>;
+  return *caches;
+}
+
+thread_local TaskNodeCache* t_cache = nullptr;
+thread_local bool t_exited = false;
+
+// Abandon the cache of current thread when the thread exits.
+struct TaskNodeCacheHolder {
+  ~TaskNodeCacheHolder() {
+    if (t_cache != nullptr) {
+      std::lock_guard<std::mutex> lock(AbandonedMutex());
+      AbandonedCaches().push_back(t_cache);
+      t_cache = nullptr;
+    }
+    t_exited = true;
+  }
+  bool attached = false;
+};
+
+thread_local TaskNodeCacheHolder t_holder;
+
+TaskNodeCache* LocalCache() {
+  if (t_cache == nullptr && !t_exited) {
+    {
+      std::lock_guard<std::mutex> lock(AbandonedMutex());
+      std::vector<TaskNodeCache*>& caches = AbandonedCaches();
+      if (!caches.empty()) {
+        t_cache = caches.back();
+        caches.pop_back();
+      }
+    }
+    if (t_cache == nullptr) {
+      t_cache = new TaskNodeCache;
+    }
+    t_holder.attached = true;
+  }
+  return t_cache;
+}
+
+}  // namespace
+
+void* TaskNodePool::Allocate(size_t size) {
+  size_t total_size = size + kHeaderSize;
+  int32_t size_class = SizeClassOf(total_size);
+  TaskNodeCache* cache = (size_class >= 0) ? LocalCache() : nullptr;
+  BlockHeader* header = nullptr;
+  if (cache != nullptr) {
+    header = cache->Pop(size_class);
+  }
+  if (header == nullptr) {
+    if (cache != nullptr) {
+      total_size = kBlockSizes[size_class];
+    }
+    header = static_cast<BlockHeader*>(::operator new(total_size));
+    header->cache = cache;
+    header->size_class = size_class;
+  }
+  return reinterpret_cast<char*>(header) + kHeaderSize;
+}
+
+void TaskNodePool::Free(void* p) {
+  if (p == nullptr) {
+    return;
+  }
+  BlockHeader* header = reinterpret_cast<BlockHeader*>(
+      reinterpret_cast<char*>(p) - kHeaderSize);
+  TaskNodeCache* cache = header->cache;
+  if (cache == nullptr) {
+    ::operator delete(header);
+  } else if (cache == t_cache) {
+    cache->PushLocal(header);
+  } else {
+    cache->PushRemote(header);
+  }
+}
+
+}  // namespace bee
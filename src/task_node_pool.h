@@ -0,0 +1,101 @@
+﻿#ifndef BEE_TASK_NODE_POOL_H
+#define BEE_TASK_NODE_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace bee {
+
+// Memory pool for task nodes, such as functor wrappers of posted tasks,
+// io_context handlers of the task scheduler and coroutine frames.
+// Every thread owns a cache with free lists of fixed size blocks, a block
+// freed by the owner thread goes back to the local free list directly, and a
+// block freed by other threads is pushed to a lock free remote list of the
+// owner, which the owner takes over as a whole when its local list is empty.
+// So a producer posting tasks to an io thread reuses the nodes freed by the
+// io thread, and no heap allocation happens at steady state.
+// Blocks larger than the biggest block size come from heap directly.
+class TaskNodePool {
+ public:
+  // Allocate a block of at least |size| bytes, aligned like operator new.
+  static void* Allocate(size_t size);
+
+  // Free a block from Allocate(), may be called from any thread.
+  static void Free(void* p);
+};
+
+// Std allocator over TaskNodePool, which is also used as associated
+// allocator of asio handlers.
+template <class T>
+class TaskNodeAllocator {
+ public:
+  typedef T value_type;
+
+  template <class U>
+  struct rebind {
+    typedef TaskNodeAllocator<U> other;
+  };
+
+  TaskNodeAllocator() = default;
+
+  template <class U>
+  TaskNodeAllocator(const TaskNodeAllocator<U>&) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(TaskNodePool::Allocate(sizeof(T) * n));
+  }
+
+  void deallocate(T* p, size_t) { TaskNodePool::Free(p); }
+
+  template <class U>
+  bool operator==(const TaskNodeAllocator<U>&) const {
+    return true;
+  }
+
+  template <class U>
+  bool operator!=(const TaskNodeAllocator<U>&) const {
+    return false;
+  }
+};
+
+// Wrapper of an asio handler with TaskNodeAllocator as associated allocator,
+// so asio allocates the operations of the handler, and beast the state of
+// composed operations, from TaskNodePool instead of heap. The io_context
+// threads of an IOService recycle the memory of their own handlers, and
+// memory freed by other threads, e.g. the resolver thread, goes back to the
+// owner through the remote list.
+template <class HandlerT>
+class TaskNodeHandler {
+ public:
+  typedef TaskNodeAllocator<void> allocator_type;
+
+  explicit TaskNodeHandler(HandlerT handler) : handler_(std::move(handler)) {}
+
+  allocator_type get_allocator() const { return allocator_type(); }
+
+  template <class... ArgT>
+  void operator()(ArgT&&... args) {
+    handler_(std::forward<ArgT>(args)...);
+  }
+
+ private:
+  HandlerT handler_;
+};
+
+// Wrap |handler| in TaskNodeHandler, e.g.
+//   socket.async_read_some(buffer, BindTaskNodeAllocator(
+//       beast::bind_front_handler(&Foo::OnRead, shared_from_this())));
+template <class HandlerT>
+TaskNodeHandler<typename std::decay<HandlerT>::type> BindTaskNodeAllocator(
+    HandlerT&& handler) {
+  return TaskNodeHandler<typename std::decay<HandlerT>::type>(
+      std::forward<HandlerT>(handler));
+}
+
+}  // namespace bee
+
+#endif  // BEE_TASK_NODE_POOL_H
@@ -0,0 +1,650 @@
+﻿#include "task_scheduler.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+#include "boost/asio/io_context.hpp"
+#if defined(__linux__)
+#include "boost/asio/posix/stream_descriptor.hpp"
+#endif
+#include "io_service.h"
+#include "trace.h"
+
+namespace bee {
+
+// Max tasks run by one drain handler before yielding to other io handlers.
+const int32_t kDrainBudget = 64;
+
+// Check injection queue first every |kInjectionInterval| pops, so that tasks
+// from other threads will not be starved by tasks posted from io thread.
+const uint32_t kInjectionInterval = 61;
+
+// With TASK_PRIORITY_POLICY_WEIGHTED, serve the lowest non-empty lane first
+// every |kLowPriorityInterval| pops.
+const uint32_t kLowPriorityInterval = 16;
+
+namespace {
+
+// Counter of tasks pushed from current thread, for sampling stats.
+thread_local uint32_t t_push_count = 0;
+
+int64_t NowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Reverse a list linked by next_, return the new head.
+FunctorWrapper* ReverseList(FunctorWrapper* head) {
+  FunctorWrapper* prev = nullptr;
+  while (head != nullptr) {
+    FunctorWrapper* next = head->next_;
+    head->next_ = prev;
+    prev = head;
+    head = next;
+  }
+  return prev;
+}
+
+}  // namespace
+
+#if defined(__linux__)
+struct TaskScheduler::WakeEvent {
+  WakeEvent(boost::asio::io_context* ioc, int fd)
+      : fd(fd), descriptor(*ioc, fd), value(0) {}
+
+  // Owned by |descriptor|, which closes it.
+  int fd;
+  boost::asio::posix::stream_descriptor descriptor;
+  uint64_t value;
+};
+#else
+struct TaskScheduler::WakeEvent {};
+#endif
+
+thread_local TaskScheduler* TaskScheduler::current_ = nullptr;
+thread_local int32_t TaskScheduler::current_index_ = 0;
+thread_local uint32_t TaskScheduler::current_tick_ = 0;
+
+TaskScheduler::TaskScheduler(boost::asio::io_context* ioc,
+                             int32_t worker_count,
+                             TaskPriorityPolicy policy,
+                             TaskQueueBackend backend)
+    : ioc_(ioc),
+      worker_count_(worker_count),
+      policy_(policy),
+      backend_((worker_count == 1) ? backend : TASK_QUEUE_BACKEND_MUTEX),
+      stats_sample_interval_(1),
+      active_drains_(0),
+      shutdown_(false),
+      limited_(false),
+      pending_tasks_(0),
+      pending_bytes_(0),
+      above_watermark_(false),
+      wake_time_(0) {
+  for (Lane& lane : lanes_) {
+    for (int32_t i = 0; i < worker_count; ++i) {
+      lane.queues.emplace_back(new WorkStealingQueue<FunctorWrapper>);
+    }
+  }
+
+#if defined(__linux__)
+  if (backend_ == TASK_QUEUE_BACKEND_MPSC) {
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd >= 0) {
+      wake_event_.reset(new WakeEvent(ioc_, fd));
+    } else {
+      printf("Create eventfd failed, wake by io_context post\n");
+    }
+  }
+#endif
+}
+
+TaskScheduler::~TaskScheduler() {
+  Clear();
+}
+
+void TaskScheduler::Clear() {
+  for (Lane& lane : lanes_) {
+    FunctorWrapper* task = nullptr;
+    while ((task = PopInjection(lane)) != nullptr) {
+      task->discard();
+    }
+    for (auto& queue : lane.queues) {
+      while ((task = queue->Steal()) != nullptr) {
+        task->discard();
+      }
+    }
+  }
+}
+
+void TaskScheduler::AttachCurrentThread(int32_t index) {
+  current_ = this;
+  current_index_ = index;
+  // Only the io_context thread touches the descriptor from now on.
+  if (wake_event_ != nullptr) {
+    ArmWakeEvent();
+  }
+}
+
+void TaskScheduler::DetachCurrentThread() {
+  current_ = nullptr;
+}
+
+void TaskScheduler::Push(FunctorWrapper* task, TaskPriority priority) {
+  if (limited_) {
+    Acquire(1, task->size_);
+  }
+  PushInternal(task, priority);
+}
+
+bool TaskScheduler::TryReserve(uint32_t size) {
+  if (!limited_) {
+    return true;
+  }
+
+  // Concurrent reservations may overshoot for a moment and refuse each
+  // other, which errs on the safe side.
+  size_t tasks = pending_tasks_.fetch_add(1, std::memory_order_relaxed) + 1;
+  size_t bytes = pending_bytes_.fetch_add(size, std::memory_order_relaxed) +
+                 size;
+  if ((limits_.max_tasks != 0 && tasks > limits_.max_tasks) ||
+      (limits_.max_bytes != 0 && bytes > limits_.max_bytes)) {
+    pending_tasks_.fetch_sub(1, std::memory_order_relaxed);
+    pending_bytes_.fetch_sub(size, std::memory_order_relaxed);
+    return false;
+  }
+  if (limits_.high_watermark != 0 && tasks >= limits_.high_watermark) {
+    NotifyWatermark(true);
+  }
+  return true;
+}
+
+void TaskScheduler::PushReserved(FunctorWrapper* task, TaskPriority priority) {
+  PushInternal(task, priority);
+}
+
+void TaskScheduler::PushInternal(FunctorWrapper* task, TaskPriority priority) {
+  BEE_TRACE_FLOW_START("task", "Task", task);
+  if (stats_ != nullptr) {
+    task->enqueue_time_ = Sample() ? NowNanos() : 0;
+  }
+
+  Lane& lane = lanes_[priority];
+  if (current_ == this) {
+    lane.queues[current_index_]->Push(task);
+  } else {
+    task->next_ = nullptr;
+    Inject(lane, task, task, 1);
+  }
+
+  Signal(1);
+}
+
+void TaskScheduler::PushBatch(FunctorWrapper* head,
+                              FunctorWrapper* tail,
+                              size_t count,
+                              TaskPriority priority) {
+  if (stats_ != nullptr) {
+    int64_t now = 0;
+    for (FunctorWrapper* task = head; task != nullptr; task = task->next_) {
+      if (Sample()) {
+        if (now == 0) {
+          now = NowNanos();
+        }
+        task->enqueue_time_ = now;
+      } else {
+        task->enqueue_time_ = 0;
+      }
+    }
+  }
+#if defined(BEE_ENABLE_TRACE)
+  for (FunctorWrapper* task = head; task != nullptr; task = task->next_) {
+    BEE_TRACE_FLOW_START("task", "Task", task);
+  }
+#endif
+  if (limited_) {
+    size_t size = 0;
+    for (FunctorWrapper* task = head; task != nullptr; task = task->next_) {
+      size += task->size_;
+    }
+    Acquire(count, size);
+  }
+
+  Lane& lane = lanes_[priority];
+  if (current_ == this) {
+    WorkStealingQueue<FunctorWrapper>* queue =
+        lane.queues[current_index_].get();
+    while (head != nullptr) {
+      FunctorWrapper* next = head->next_;
+      queue->Push(head);
+      head = next;
+    }
+  } else {
+    tail->next_ = nullptr;
+    Inject(lane, head, tail, count);
+  }
+
+  Signal(count);
+}
+
+size_t TaskScheduler::QueueDepth(TaskPriority priority) {
+  Lane& lane = lanes_[priority];
+  size_t depth = lane.injection_size.load(std::memory_order_relaxed);
+  for (auto& queue : lane.queues) {
+    // Size of a queue may be negative for a moment while being stolen.
+    int64_t size = queue->Size();
+    if (size > 0) {
+      depth += static_cast<size_t>(size);
+    }
+  }
+  return depth;
+}
+
+void TaskScheduler::SetLimits(const TaskQueueLimits& limits) {
+  limits_ = limits;
+  limited_ = (limits.max_tasks != 0 || limits.max_bytes != 0 ||
+              limits.high_watermark != 0);
+}
+
+void TaskScheduler::EnableStats(int32_t sample_interval) {
+  stats_.reset(new WorkerStats[worker_count_]);
+  stats_sample_interval_ = static_cast<uint32_t>(std::max(sample_interval, 1));
+}
+
+IOServiceStats TaskScheduler::GetStats() {
+  IOServiceStats result;
+  for (int32_t i = 0; i < TASK_PRIORITY_COUNT; ++i) {
+    result.queue_depth[i] = QueueDepth(static_cast<TaskPriority>(i));
+  }
+  if (stats_ == nullptr) {
+    return result;
+  }
+
+  Histogram WorkerStats::*histograms[] = {
+      &WorkerStats::queue_depth, &WorkerStats::queue_latency,
+      &WorkerStats::run_time, &WorkerStats::wakeup_latency};
+  HistogramStats* summaries[] = {&result.queue_depth_samples,
+                                 &result.queue_latency, &result.run_time,
+                                 &result.wakeup_latency};
+  std::vector<uint64_t> counts(Histogram::kBucketCount);
+  for (int32_t i = 0; i < 4; ++i) {
+    std::fill(counts.begin(), counts.end(), 0);
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t min = UINT64_MAX;
+    uint64_t max = 0;
+    for (int32_t j = 0; j < worker_count_; ++j) {
+      (stats_[j].*histograms[i])
+          .Accumulate(counts.data(), &count, &sum, &min, &max);
+    }
+    *summaries[i] = Histogram::Summarize(counts.data(), count, sum, min, max);
+  }
+  return result;
+}
+
+void TaskScheduler::EnableWatch() {
+  watch_slots_.reset(new WatchSlot[worker_count_]);
+  for (int32_t i = 0; i < worker_count_; ++i) {
+    watch_slots_[i].sequence.store(0, std::memory_order_relaxed);
+    watch_slots_[i].file.store(nullptr, std::memory_order_relaxed);
+    watch_slots_[i].line.store(0, std::memory_order_relaxed);
+  }
+}
+
+bool TaskScheduler::RunningTask(int32_t index,
+                                uint64_t* sequence,
+                                Location* location) {
+  if (watch_slots_ == nullptr || index < 0 || index >= worker_count_) {
+    return false;
+  }
+
+  // The location may be torn if the task changes while sampling, which is
+  // harmless, for a slow task is only reported after being sampled twice.
+  WatchSlot& slot = watch_slots_[index];
+  *sequence = slot.sequence.load(std::memory_order_acquire);
+  *location = Location(slot.file.load(std::memory_order_relaxed),
+                       slot.line.load(std::memory_order_relaxed));
+  return (*sequence & 1) != 0;
+}
+
+void TaskScheduler::Shutdown() {
+  shutdown_ = true;
+}
+
+void TaskScheduler::Drain(int64_t wakeup_time) {
+  // Drain handlers only run on attached io_context threads, so the stats of
+  // current thread have a single writer.
+  WorkerStats* stats = nullptr;
+  if (stats_ != nullptr && current_ == this) {
+    stats = &stats_[current_index_];
+    stats->queue_depth.Record(TotalDepth());
+    if (wakeup_time != 0) {
+      stats->wakeup_latency.Record(static_cast<uint64_t>(
+          std::max<int64_t>(NowNanos() - wakeup_time, 0)));
+    }
+  }
+  WatchSlot* watch_slot = nullptr;
+  if (watch_slots_ != nullptr && current_ == this) {
+    watch_slot = &watch_slots_[current_index_];
+  }
+
+  for (int32_t i = 0; i < kDrainBudget; ++i) {
+    if (shutdown_.load(std::memory_order_relaxed)) {
+      return;
+    }
+
+    FunctorWrapper* task = Pop();
+    if (task == nullptr) {
+      // Release the drain slot, then check again in case a task was pushed
+      // after Pop() but before the slot was released.
+      active_drains_.fetch_sub(1);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (Empty() || !TryAcquireDrain()) {
+        return;
+      }
+      continue;
+    }
+
+    if (limited_) {
+      Release(task);
+    }
+    BEE_TRACE_FLOW_SCOPE("task", "Task", task, task->location_);
+    if (watch_slot != nullptr) {
+      BeginWatch(watch_slot, task);
+    }
+    if (stats != nullptr && task->enqueue_time_ != 0) {
+      ExecuteWithStats(task, stats);
+    } else {
+      task->execute();
+    }
+    if (watch_slot != nullptr) {
+      EndWatch(watch_slot);
+    }
+  }
+
+  // Budget exhausted, keep the slot but give other io handlers a chance.
+  PostDrain(false);
+}
+
+void TaskScheduler::Acquire(size_t count, size_t size) {
+  size_t tasks =
+      pending_tasks_.fetch_add(count, std::memory_order_relaxed) + count;
+  pending_bytes_.fetch_add(size, std::memory_order_relaxed);
+  if (limits_.high_watermark != 0 && tasks >= limits_.high_watermark) {
+    NotifyWatermark(true);
+  }
+}
+
+void TaskScheduler::Release(FunctorWrapper* task) {
+  size_t tasks = pending_tasks_.fetch_sub(1, std::memory_order_relaxed) - 1;
+  pending_bytes_.fetch_sub(task->size_, std::memory_order_relaxed);
+  if (limits_.high_watermark != 0 && tasks <= limits_.low_watermark) {
+    NotifyWatermark(false);
+  }
+}
+
+void TaskScheduler::NotifyWatermark(bool high) {
+  // Only transitions take the lock, the callback sees alternate calls.
+  if (above_watermark_.load(std::memory_order_relaxed) == high) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(watermark_mutex_);
+  size_t tasks = pending_tasks_.load(std::memory_order_relaxed);
+  bool crossed = high ? (tasks >= limits_.high_watermark)
+                      : (tasks <= limits_.low_watermark);
+  if (!crossed || above_watermark_.load(std::memory_order_relaxed) == high) {
+    return;
+  }
+  above_watermark_.store(high, std::memory_order_relaxed);
+  if (limits_.watermark_callback) {
+    limits_.watermark_callback(high);
+  }
+}
+
+void TaskScheduler::BeginWatch(WatchSlot* slot, FunctorWrapper* task) {
+  slot->file.store(task->location_.File(), std::memory_order_relaxed);
+  slot->line.store(task->location_.Line(), std::memory_order_relaxed);
+  slot->sequence.store(slot->sequence.load(std::memory_order_relaxed) + 1,
+                       std::memory_order_release);
+}
+
+void TaskScheduler::EndWatch(WatchSlot* slot) {
+  slot->sequence.store(slot->sequence.load(std::memory_order_relaxed) + 1,
+                       std::memory_order_release);
+}
+
+void TaskScheduler::ExecuteWithStats(FunctorWrapper* task,
+                                     WorkerStats* stats) {
+  int64_t start = NowNanos();
+  stats->queue_latency.Record(static_cast<uint64_t>(
+      std::max<int64_t>(start - task->enqueue_time_, 0)));
+  task->execute();
+  stats->run_time.Record(static_cast<uint64_t>(NowNanos() - start));
+}
+
+bool TaskScheduler::Sample() {
+  return ++t_push_count % stats_sample_interval_ == 0;
+}
+
+size_t TaskScheduler::TotalDepth() {
+  size_t depth = 0;
+  for (int32_t i = 0; i < TASK_PRIORITY_COUNT; ++i) {
+    depth += QueueDepth(static_cast<TaskPriority>(i));
+  }
+  return depth;
+}
+
+FunctorWrapper* TaskScheduler::Pop() {
+  uint32_t tick = ++current_tick_;
+  bool injection_first = (tick % kInjectionInterval == 0);
+  FunctorWrapper* task = nullptr;
+  if (policy_ == TASK_PRIORITY_POLICY_WEIGHTED &&
+      tick % kLowPriorityInterval == 0) {
+    for (int32_t i = TASK_PRIORITY_COUNT - 1; i >= 0; --i) {
+      task = PopLane(lanes_[i], injection_first);
+      if (task != nullptr) {
+        return task;
+      }
+    }
+    return nullptr;
+  }
+
+  for (Lane& lane : lanes_) {
+    task = PopLane(lane, injection_first);
+    if (task != nullptr) {
+      return task;
+    }
+  }
+  return nullptr;
+}
+
+FunctorWrapper* TaskScheduler::PopLane(Lane& lane, bool injection_first) {
+  FunctorWrapper* task = nullptr;
+  bool local = (current_ == this);
+  if (local && injection_first) {
+    task = PopInjection(lane);
+    if (task != nullptr) {
+      return task;
+    }
+  }
+
+  if (local) {
+    task = lane.queues[current_index_]->Steal();
+    if (task != nullptr) {
+      return task;
+    }
+  }
+
+  task = PopInjection(lane);
+  if (task != nullptr) {
+    return task;
+  }
+
+  return StealOthers(lane);
+}
+
+FunctorWrapper* TaskScheduler::PopInjection(Lane& lane) {
+  if (lane.injection_size.load(std::memory_order_relaxed) == 0) {
+    return nullptr;
+  }
+
+  if (backend_ == TASK_QUEUE_BACKEND_MPSC) {
+    return PopLockFree(lane);
+  }
+
+  std::lock_guard<std::mutex> lock(lane.injection_mutex);
+  FunctorWrapper* task = lane.injection_head;
+  if (task == nullptr) {
+    return nullptr;
+  }
+  lane.injection_head = task->next_;
+  if (lane.injection_head == nullptr) {
+    lane.injection_tail = nullptr;
+  }
+  lane.injection_size.fetch_sub(1, std::memory_order_relaxed);
+  return task;
+}
+
+FunctorWrapper* TaskScheduler::PopLockFree(Lane& lane) {
+  // Called by the only io_context thread, or by the destructor after it
+  // exits, so there is a single consumer.
+  FunctorWrapper* task = lane.mpsc_pending;
+  if (task == nullptr) {
+    task = ReverseList(
+        lane.mpsc_head.exchange(nullptr, std::memory_order_acquire));
+    if (task == nullptr) {
+      return nullptr;
+    }
+  }
+  lane.mpsc_pending = task->next_;
+  lane.injection_size.fetch_sub(1, std::memory_order_relaxed);
+  return task;
+}
+
+FunctorWrapper* TaskScheduler::StealOthers(Lane& lane) {
+  // Start from the next worker so that victims are spread.
+  int32_t start = (current_ == this) ? current_index_ + 1 : 0;
+  for (int32_t i = 0; i < worker_count_; ++i) {
+    int32_t index = (start + i) % worker_count_;
+    if (current_ == this && index == current_index_) {
+      continue;
+    }
+    FunctorWrapper* task = lane.queues[index]->Steal();
+    if (task != nullptr) {
+      return task;
+    }
+  }
+  return nullptr;
+}
+
+void TaskScheduler::Inject(Lane& lane,
+                           FunctorWrapper* head,
+                           FunctorWrapper* tail,
+                           size_t count) {
+  if (backend_ == TASK_QUEUE_BACKEND_MPSC) {
+    InjectLockFree(lane, head, tail, count);
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(lane.injection_mutex);
+  if (lane.injection_tail != nullptr) {
+    lane.injection_tail->next_ = head;
+  } else {
+    lane.injection_head = head;
+  }
+  lane.injection_tail = tail;
+  lane.injection_size.fetch_add(count, std::memory_order_relaxed);
+}
+
+void TaskScheduler::InjectLockFree(Lane& lane,
+                                   FunctorWrapper* head,
+                                   FunctorWrapper* tail,
+                                   size_t count) {
+  // Count before publishing, so the consumer never takes more tasks than
+  // counted. The stack keeps the newest task on top, so the batch is linked
+  // backwards, from |tail| down to |head|.
+  lane.injection_size.fetch_add(count, std::memory_order_relaxed);
+  ReverseList(head);
+  FunctorWrapper* top = lane.mpsc_head.load(std::memory_order_relaxed);
+  do {
+    head->next_ = top;
+  } while (!lane.mpsc_head.compare_exchange_weak(
+      top, tail, std::memory_order_release, std::memory_order_relaxed));
+}
+
+bool TaskScheduler::Empty() {
+  for (Lane& lane : lanes_) {
+    if (lane.injection_size.load(std::memory_order_relaxed) != 0) {
+      return false;
+    }
+    for (auto& queue : lane.queues) {
+      if (!queue->Empty()) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void TaskScheduler::Signal(size_t count) {
+  // Pairs with the fence in Drain(), either the drain handler sees the task,
+  // or we see the drain slot it released.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  // Wake at most one io_context thread per task.
+  for (size_t i = 0; i < count && TryAcquireDrain(); ++i) {
+    PostDrain(true);
+  }
+}
+
+bool TaskScheduler::TryAcquireDrain() {
+  int32_t active = active_drains_.load();
+  while (active < worker_count_) {
+    if (active_drains_.compare_exchange_weak(active, active + 1)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void TaskScheduler::PostDrain(bool wakeup) {
+  int64_t wakeup_time = (wakeup && stats_ != nullptr) ? NowNanos() : 0;
+#if defined(__linux__)
+  // The drain slot is only free when the io_context thread is parked, so
+  // the eventfd is written at most once per park, and a running thread only
+  // sees a fence and a failed slot check in Signal().
+  if (wakeup && wake_event_ != nullptr) {
+    wake_time_.store(wakeup_time, std::memory_order_relaxed);
+    uint64_t one = 1;
+    ssize_t size = write(wake_event_->fd, &one, sizeof(one));
+    (void)size;
+    return;
+  }
+#endif
+  ioc_->post(DrainHandler(shared_from_this(), wakeup_time));
+}
+
+void TaskScheduler::ArmWakeEvent() {
+#if defined(__linux__)
+  wake_event_->descriptor.async_read_some(
+      boost::asio::buffer(&wake_event_->value, sizeof(wake_event_->value)),
+      WakeHandler(shared_from_this()));
+#endif
+}
+
+void TaskScheduler::OnWakeEvent() {
+  // The read has reset the eventfd, writes after it complete the next read.
+  Drain(wake_time_.exchange(0, std::memory_order_relaxed));
+  if (!shutdown_.load(std::memory_order_relaxed)) {
+    ArmWakeEvent();
+  }
+}
+
+}  // namespace bee
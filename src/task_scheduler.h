@@ -0,0 +1,320 @@
+﻿#ifndef BEE_TASK_SCHEDULER_H
+#define BEE_TASK_SCHEDULER_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "histogram.h"
+#include "location.h"
+#include "task_node_pool.h"
+#include "work_stealing_queue.h"
+
+// Forward declaration for hiding boost headers.
+namespace boost {
+namespace asio {
+class io_context;
+}  // namespace asio
+}  // namespace boost
+
+namespace bee {
+
+class FunctorWrapper;
+
+// Priority of tasks, tasks of a higher priority are executed first.
+enum TaskPriority {
+  // Latency sensitive tasks, e.g. control messages, heartbeats.
+  TASK_PRIORITY_HIGH,
+  // Default priority.
+  TASK_PRIORITY_NORMAL,
+  // Bulk work that may be delayed, e.g. logs, statistics.
+  TASK_PRIORITY_BACKGROUND,
+  TASK_PRIORITY_COUNT
+};
+
+// How tasks of different priorities are picked.
+enum TaskPriorityPolicy {
+  // Always pick the highest priority task, lower lanes may starve.
+  TASK_PRIORITY_POLICY_STRICT,
+  // Pick the highest priority task, except one pick out of every
+  // kLowPriorityInterval which serves the lowest non-empty lane, so lower
+  // lanes keep moving under a flood of higher priority tasks.
+  TASK_PRIORITY_POLICY_WEIGHTED
+};
+
+// Queue of tasks posted from threads other than io_context threads.
+enum TaskQueueBackend {
+  // Mutex protected injection queues, an idle io_context thread is woken by
+  // posting a drain handler to io_context.
+  TASK_QUEUE_BACKEND_MUTEX,
+  // Lock free intrusive MPSC queues, an idle io_context thread is woken by
+  // an eventfd registered with io_context on Linux, and by posting a drain
+  // handler elsewhere. It has a single consumer, so it's only used by a
+  // scheduler of one io_context thread, others fall back to
+  // TASK_QUEUE_BACKEND_MUTEX.
+  TASK_QUEUE_BACKEND_MPSC
+};
+
+// Limits of tasks waiting to be executed by an IOService, over all lanes.
+// Tasks are counted from being pushed to being picked, delayed tasks only
+// after they are due.
+struct TaskQueueLimits {
+  // Max tasks and bytes of functor wrappers waiting, 0 for no limit.
+  // IOService::TryPostTask() refuses a task beyond them.
+  size_t max_tasks = 0;
+  size_t max_bytes = 0;
+  // Watermarks in tasks, 0 |high_watermark| disables |watermark_callback|.
+  size_t high_watermark = 0;
+  size_t low_watermark = 0;
+  // Called with true when waiting tasks reach |high_watermark|, and with
+  // false when they fall back to |low_watermark|, so producers can shed or
+  // coalesce work. Calls alternate and never overlap, it's called on the
+  // thread crossing the watermark, a producer or an io_context thread, so it
+  // must be cheap and must not post tasks to the IOService.
+  std::function<void(bool high)> watermark_callback;
+};
+
+// Snapshot of task statistics of an IOService, times are in nanoseconds.
+struct IOServiceStats {
+  // Tasks waiting in each lane when the snapshot is taken.
+  size_t queue_depth[TASK_PRIORITY_COUNT] = {};
+  // Tasks waiting in all lanes, sampled when each drain handler starts.
+  HistogramStats queue_depth_samples;
+  // Time from being posted to being started, of sampled tasks.
+  HistogramStats queue_latency;
+  // Time of running, of sampled tasks.
+  HistogramStats run_time;
+  // Time from an idle io_context being signaled to a drain handler starting,
+  // which shows the cost of waking an io_context thread.
+  HistogramStats wakeup_latency;
+};
+
+// Work stealing scheduler for IOService tasks.
+// Tasks are queued in lanes by priority. In every lane, each io_context
+// thread owns a WorkStealingQueue for tasks posted from itself, and tasks
+// posted from other threads go to an injection queue of the lane.
+// Tasks are executed in batches by drain handlers posted to io_context, so a
+// burst of tasks costs only a few io_context posts, and an idle io_context
+// thread steals tasks queued on a busy one.
+// See TaskQueueBackend for the injection queues and how an idle io_context
+// thread is woken.
+class TaskScheduler : public std::enable_shared_from_this<TaskScheduler> {
+ public:
+  TaskScheduler(boost::asio::io_context* ioc,
+                int32_t worker_count,
+                TaskPriorityPolicy policy = TASK_PRIORITY_POLICY_WEIGHTED,
+                TaskQueueBackend backend = TASK_QUEUE_BACKEND_MUTEX);
+  ~TaskScheduler();
+
+ public:
+  // Bind current io_context thread to worker |index|, call on the
+  // io_context thread before it runs io_context.
+  void AttachCurrentThread(int32_t index);
+
+  // Unbind current io_context thread.
+  void DetachCurrentThread();
+
+  // Push a task of |priority| from any thread, take ownership of |task|.
+  void Push(FunctorWrapper* task,
+            TaskPriority priority = TASK_PRIORITY_NORMAL);
+
+  // Push |count| tasks of |priority| linked from |head| to |tail| from any
+  // thread, take ownership of all of them.
+  void PushBatch(FunctorWrapper* head,
+                 FunctorWrapper* tail,
+                 size_t count,
+                 TaskPriority priority = TASK_PRIORITY_NORMAL);
+
+  // Reserve room for a task of |size| bytes against the limits, return false
+  // if it does not fit. A reserved task must be pushed by PushReserved().
+  bool TryReserve(uint32_t size);
+
+  // Push a task reserved by TryReserve(), take ownership of |task|.
+  void PushReserved(FunctorWrapper* task,
+                    TaskPriority priority = TASK_PRIORITY_NORMAL);
+
+  // Return number of tasks of |priority| waiting to be executed, it's a
+  // snapshot which may be stale as soon as it returns.
+  size_t QueueDepth(TaskPriority priority);
+
+  // Count waiting tasks against |limits|, call before any task is pushed.
+  void SetLimits(const TaskQueueLimits& limits);
+
+  // Record statistics of tasks, latency and run time of one in
+  // |sample_interval| tasks, call before any task is pushed.
+  void EnableStats(int32_t sample_interval);
+
+  // Return statistics of tasks, empty if stats are not enabled.
+  IOServiceStats GetStats();
+
+  // Publish the task running on every io_context thread for TaskWatchdog,
+  // call before any task is pushed.
+  void EnableWatch();
+
+  // Sample the task running on worker |index|, return false if the worker is
+  // idle or watch is not enabled. |sequence| tells different tasks apart.
+  bool RunningTask(int32_t index, uint64_t* sequence, Location* location);
+
+  int32_t WorkerCount() const { return worker_count_; }
+
+  // Return the backend in use, which may differ from the one requested.
+  TaskQueueBackend Backend() const { return backend_; }
+
+  // Stop executing tasks, tasks left will be deleted without running.
+  void Shutdown();
+
+  // Delete tasks left without running, call after Shutdown() when no
+  // io_context thread runs any more.
+  void Clear();
+
+ private:
+  // Drain handler posted to io_context, allocated from TaskNodePool.
+  class DrainHandler {
+   public:
+    typedef TaskNodeAllocator<void> allocator_type;
+
+    DrainHandler(std::shared_ptr<TaskScheduler> scheduler, int64_t wakeup_time)
+        : scheduler_(std::move(scheduler)), wakeup_time_(wakeup_time) {}
+
+    allocator_type get_allocator() const { return allocator_type(); }
+
+    void operator()() { scheduler_->Drain(wakeup_time_); }
+
+   private:
+    std::shared_ptr<TaskScheduler> scheduler_;
+    // Steady clock nanoseconds when posted to wake io_context, 0 if not
+    // recorded.
+    int64_t wakeup_time_;
+  };
+
+  // Eventfd of TASK_QUEUE_BACKEND_MPSC, defined in cpp to hide boost.
+  struct WakeEvent;
+
+  // Handler of WakeEvent readable, allocated from TaskNodePool. It doesn't
+  // keep the scheduler alive, for the scheduler owns the pending read.
+  class WakeHandler {
+   public:
+    typedef TaskNodeAllocator<void> allocator_type;
+
+    explicit WakeHandler(std::weak_ptr<TaskScheduler> scheduler)
+        : scheduler_(std::move(scheduler)) {}
+
+    allocator_type get_allocator() const { return allocator_type(); }
+
+    template <class ErrorCodeT>
+    void operator()(const ErrorCodeT& ec, size_t) {
+      std::shared_ptr<TaskScheduler> scheduler = scheduler_.lock();
+      if (!ec && scheduler != nullptr) {
+        scheduler->OnWakeEvent();
+      }
+    }
+
+   private:
+    std::weak_ptr<TaskScheduler> scheduler_;
+  };
+
+  // Tasks of one priority.
+  struct Lane {
+    Lane()
+        : injection_head(nullptr),
+          injection_tail(nullptr),
+          injection_size(0),
+          mpsc_head(nullptr),
+          mpsc_pending(nullptr) {}
+
+    std::vector<std::unique_ptr<WorkStealingQueue<FunctorWrapper>>> queues;
+    std::mutex injection_mutex;
+    FunctorWrapper* injection_head;
+    FunctorWrapper* injection_tail;
+    std::atomic<size_t> injection_size;
+    // Injection queue of TASK_QUEUE_BACKEND_MPSC, a lock free stack pushed
+    // by producers with the newest task on top, which the consumer takes as
+    // a whole into |mpsc_pending|, oldest first.
+    std::atomic<FunctorWrapper*> mpsc_head;
+    FunctorWrapper* mpsc_pending;
+  };
+
+  // Histograms of one io_context thread, written by the thread only.
+  struct WorkerStats {
+    Histogram queue_depth;
+    Histogram queue_latency;
+    Histogram run_time;
+    Histogram wakeup_latency;
+  };
+
+  // Running task of one io_context thread, written by the thread only.
+  // |sequence| is odd while a task is running.
+  struct WatchSlot {
+    std::atomic<uint64_t> sequence;
+    std::atomic<const char*> file;
+    std::atomic<int32_t> line;
+    // Keep slots of different threads in different cache lines.
+    char padding[64];
+  };
+
+  void Drain(int64_t wakeup_time);
+  void PushInternal(FunctorWrapper* task, TaskPriority priority);
+  void Acquire(size_t count, size_t size);
+  void Release(FunctorWrapper* task);
+  void NotifyWatermark(bool high);
+  void BeginWatch(WatchSlot* slot, FunctorWrapper* task);
+  void EndWatch(WatchSlot* slot);
+  void ExecuteWithStats(FunctorWrapper* task, WorkerStats* stats);
+  // Return if the task pushed now is sampled for stats.
+  bool Sample();
+  size_t TotalDepth();
+  FunctorWrapper* Pop();
+  FunctorWrapper* PopLane(Lane& lane, bool injection_first);
+  FunctorWrapper* PopInjection(Lane& lane);
+  FunctorWrapper* StealOthers(Lane& lane);
+  FunctorWrapper* PopLockFree(Lane& lane);
+  void Inject(Lane& lane, FunctorWrapper* head, FunctorWrapper* tail,
+              size_t count);
+  void InjectLockFree(Lane& lane, FunctorWrapper* head, FunctorWrapper* tail,
+                      size_t count);
+  bool Empty();
+  void Signal(size_t count);
+  bool TryAcquireDrain();
+  void PostDrain(bool wakeup);
+  void ArmWakeEvent();
+  void OnWakeEvent();
+
+ private:
+  boost::asio::io_context* ioc_;
+  const int32_t worker_count_;
+  const TaskPriorityPolicy policy_;
+  const TaskQueueBackend backend_;
+  Lane lanes_[TASK_PRIORITY_COUNT];
+  // Stats of each worker, nullptr if stats are not enabled.
+  std::unique_ptr<WorkerStats[]> stats_;
+  uint32_t stats_sample_interval_;
+  // Watch slots of each worker, nullptr if watch is not enabled.
+  std::unique_ptr<WatchSlot[]> watch_slots_;
+  // Number of drain handlers posted to io_context and not finished.
+  std::atomic<int32_t> active_drains_;
+  std::atomic<bool> shutdown_;
+  TaskQueueLimits limits_;
+  // If tasks are counted, i.e. any limit or watermark is set.
+  bool limited_;
+  // Tasks and bytes waiting, counted only if |limited_|.
+  std::atomic<size_t> pending_tasks_;
+  std::atomic<size_t> pending_bytes_;
+  // If above high watermark, flipped under |watermark_mutex_|.
+  std::atomic<bool> above_watermark_;
+  std::mutex watermark_mutex_;
+  // Eventfd to wake the io_context thread, nullptr if not used.
+  std::unique_ptr<WakeEvent> wake_event_;
+  // Steady clock nanoseconds when |wake_event_| is signaled, 0 if not
+  // recorded.
+  std::atomic<int64_t> wake_time_;
+  static thread_local TaskScheduler* current_;
+  static thread_local int32_t current_index_;
+  static thread_local uint32_t current_tick_;
+};
+
+}  // namespace bee
+
+#endif  // BEE_TASK_SCHEDULER_H
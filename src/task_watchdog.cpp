@@ -0,0 +1,141 @@
+﻿#include "task_watchdog.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+#include "task_scheduler.h"
+#include "xlog/log/xloggerbase.h"
+
+// xlog is only linked into the Windows project, elsewhere the watchdog falls
+// back to stdout if no xlog is linked.
+#if defined(__GNUC__) && !defined(_WIN32)
+#define BEE_XLOG_WEAK 1
+extern "C" {
+int xlogger_IsEnabledFor(TLogLevel _level) __attribute__((weak));
+void xlogger_Write(const XLoggerInfo* _info, const char* _log)
+    __attribute__((weak));
+}
+#endif
+
+namespace bee {
+
+namespace {
+
+const char* kLogTag = "bee";
+
+void LogSlowTask(const Location& location, const char* message) {
+#if defined(BEE_XLOG_WEAK)
+  if (xlogger_Write == nullptr || xlogger_IsEnabledFor == nullptr) {
+    printf("[%s] %s\n", kLogTag, message);
+    return;
+  }
+#endif
+  if (!xlogger_IsEnabledFor(kLevelWarn)) {
+    return;
+  }
+
+  int64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::system_clock::now().time_since_epoch())
+                    .count();
+  XLoggerInfo info;
+  info.level = kLevelWarn;
+  info.tag = kLogTag;
+  info.filename = (location.File() != nullptr) ? location.File() : "";
+  info.func_name = "";
+  info.line = location.Line();
+  info.timeval.tv_sec = static_cast<long>(now / 1000000);
+  info.timeval.tv_usec = static_cast<long>(now % 1000000);
+  info.pid = -1;
+  info.tid = -1;
+  info.maintid = -1;
+  xlogger_Write(&info, message);
+}
+
+}  // namespace
+
+TaskWatchdog::TaskWatchdog(std::shared_ptr<TaskScheduler> scheduler,
+                           int32_t threshold)
+    : scheduler_(scheduler),
+      threshold_(threshold),
+      interval_(std::max<int32_t>(threshold / 4, 1)),
+      states_(scheduler->WorkerCount()) {}
+
+TaskWatchdog::~TaskWatchdog() {
+  Stop();
+}
+
+void TaskWatchdog::Start() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (thread_.joinable()) {
+    return;
+  }
+  stopped_ = false;
+  thread_ = std::thread(&TaskWatchdog::Run, this);
+}
+
+void TaskWatchdog::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+  }
+  cond_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void TaskWatchdog::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!cond_.wait_for(lock, interval_, [this] { return stopped_; })) {
+    std::chrono::steady_clock::time_point now =
+        std::chrono::steady_clock::now();
+    for (int32_t i = 0; i < static_cast<int32_t>(states_.size()); ++i) {
+      Check(i, &states_[i], now);
+    }
+  }
+}
+
+void TaskWatchdog::Check(int32_t index,
+                         WorkerState* state,
+                         std::chrono::steady_clock::time_point now) {
+  uint64_t sequence = 0;
+  Location location;
+  bool running = scheduler_->RunningTask(index, &sequence, &location);
+  if (running && sequence == state->sequence) {
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          now - state->since)
+                          .count();
+    if (!state->reported && elapsed >= threshold_.count()) {
+      char message[256];
+      snprintf(message, sizeof(message),
+               "Slow task posted from %s:%d is running on thread %d for %lld "
+               "ms.",
+               (location.File() != nullptr) ? location.File() : "unknown",
+               location.Line(), index, static_cast<long long>(elapsed));
+      LogSlowTask(location, message);
+      state->location = location;
+      state->reported = true;
+    }
+    return;
+  }
+
+  if (state->reported) {
+    // The task finished some time within the last interval.
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          now - state->since)
+                          .count();
+    char message[256];
+    snprintf(message, sizeof(message),
+             "Slow task posted from %s:%d finished on thread %d in about %lld "
+             "ms.",
+             (state->location.File() != nullptr) ? state->location.File()
+                                                 : "unknown",
+             state->location.Line(), index, static_cast<long long>(elapsed));
+    LogSlowTask(state->location, message);
+  }
+  state->sequence = sequence;
+  state->since = now;
+  state->reported = false;
+}
+
+}  // namespace bee
@@ -0,0 +1,63 @@
+﻿#ifndef BEE_TASK_WATCHDOG_H
+#define BEE_TASK_WATCHDOG_H
+
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "location.h"
+
+namespace bee {
+
+class TaskScheduler;
+
+// Watchdog thread of slow tasks. It samples the task running on every
+// io_context thread of |scheduler| periodically, and logs a task running
+// longer than |threshold| milliseconds through xlog with the location where
+// it's posted, and logs again when the task finishes.
+// Workers only publish what they are running, no clock is read on the task
+// path, so the elapsed time reported is accurate to the sampling interval.
+class TaskWatchdog {
+ public:
+  TaskWatchdog(std::shared_ptr<TaskScheduler> scheduler, int32_t threshold);
+  ~TaskWatchdog();
+
+  void Start();
+
+  // Stop and join the watchdog thread.
+  void Stop();
+
+ private:
+  // Last sample of one worker.
+  struct WorkerState {
+    uint64_t sequence = 0;
+    Location location;
+    std::chrono::steady_clock::time_point since;
+    bool reported = false;
+  };
+
+  TaskWatchdog(const TaskWatchdog&) = delete;
+  TaskWatchdog& operator=(const TaskWatchdog&) = delete;
+
+  void Run();
+  void Check(int32_t index,
+             WorkerState* state,
+             std::chrono::steady_clock::time_point now);
+
+  std::shared_ptr<TaskScheduler> scheduler_;
+  std::chrono::milliseconds threshold_;
+  std::chrono::milliseconds interval_;
+  std::vector<WorkerState> states_;
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool stopped_ = false;
+};
+
+}  // namespace bee
+
+#endif  // BEE_TASK_WATCHDOG_H
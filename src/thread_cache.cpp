@@ -0,0 +1,187 @@
+﻿#include "thread_cache.h"
+
+#include <condition_variable>
+#include <iterator>
+#include <mutex>
+#include <vector>
+
+#include "completion.h"
+#include "platform_thread.h"
+
+namespace bee {
+
+struct CachedThread::State {
+  std::function<void()> function;
+  Completion done;
+};
+
+namespace {
+
+const size_t kDefaultCapacity = 16;
+
+// A thread of the cache, owned by the thread itself.
+struct Worker {
+  size_t stack_size = 0;
+  std::mutex mutex;
+  std::condition_variable cond;
+  // Function to run next, nullptr while parked.
+  std::shared_ptr<CachedThread::State> job;
+};
+
+struct Cache {
+  std::mutex mutex;
+  std::vector<Worker*> parked;
+  size_t capacity = kDefaultCapacity;
+};
+
+// Never deleted, for parked threads use it until the process exits.
+Cache& GetCache() {
+  static Cache* cache = new Cache;
+  return *cache;
+}
+
+thread_local CachedThread::State* t_current_state = nullptr;
+thread_local bool t_discard_current = false;
+
+// Park |worker| after a function returns, return false if the cache is full
+// and the thread should exit.
+bool Park(Worker* worker) {
+  Cache& cache = GetCache();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  if (cache.parked.size() >= cache.capacity) {
+    return false;
+  }
+  cache.parked.push_back(worker);
+  return true;
+}
+
+void WorkerMain(Worker* worker) {
+  while (true) {
+    std::shared_ptr<CachedThread::State> state;
+    {
+      std::unique_lock<std::mutex> lock(worker->mutex);
+      worker->cond.wait(lock, [worker] { return worker->job != nullptr; });
+      state = std::move(worker->job);
+    }
+
+    t_current_state = state.get();
+    state->function();
+    // Release what the function holds before the joiner wakes up.
+    state->function = nullptr;
+    t_current_state = nullptr;
+
+    // Park before waking the joiner, so that a Start() right after Stop()
+    // finds the thread. A new job set meanwhile is picked up by the wait.
+    bool parked = !t_discard_current && Park(worker);
+    state->done.Notify();
+    state.reset();
+    if (!parked) {
+      break;
+    }
+  }
+  delete worker;
+}
+
+}  // namespace
+
+CachedThread::CachedThread(std::shared_ptr<State> state)
+    : state_(std::move(state)) {}
+
+CachedThread::~CachedThread() {
+  Detach();
+}
+
+void CachedThread::Join() {
+  if (state_ != nullptr) {
+    state_->done.Wait();
+    state_.reset();
+  }
+}
+
+void CachedThread::Detach() {
+  state_.reset();
+}
+
+bool CachedThread::IsCurrent() const {
+  return state_ != nullptr && t_current_state == state_.get();
+}
+
+std::unique_ptr<CachedThread> ThreadCache::Run(std::function<void()> function,
+                                               size_t stack_size) {
+  std::shared_ptr<CachedThread::State> state =
+      std::make_shared<CachedThread::State>();
+  state->function = std::move(function);
+
+  Worker* worker = nullptr;
+  {
+    Cache& cache = GetCache();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    for (auto iter = cache.parked.rbegin(); iter != cache.parked.rend();
+         ++iter) {
+      if ((*iter)->stack_size == stack_size) {
+        worker = *iter;
+        cache.parked.erase(std::next(iter).base());
+        break;
+      }
+    }
+  }
+
+  if (worker != nullptr) {
+    {
+      std::lock_guard<std::mutex> lock(worker->mutex);
+      worker->job = state;
+    }
+    worker->cond.notify_one();
+    return std::unique_ptr<CachedThread>(new CachedThread(state));
+  }
+
+  worker = new Worker;
+  worker->stack_size = stack_size;
+  worker->job = state;
+  std::unique_ptr<PlatformThread> thread =
+      PlatformThread::Create([worker] { WorkerMain(worker); }, stack_size);
+  if (thread == nullptr) {
+    delete worker;
+    return nullptr;
+  }
+  thread->Detach();
+  return std::unique_ptr<CachedThread>(new CachedThread(state));
+}
+
+void ThreadCache::SetCapacity(size_t capacity) {
+  std::vector<Worker*> evicted;
+  {
+    Cache& cache = GetCache();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    cache.capacity = capacity;
+    while (cache.parked.size() > capacity) {
+      evicted.push_back(cache.parked.back());
+      cache.parked.pop_back();
+    }
+  }
+
+  // Wake evicted threads with an empty function, they exit when parking
+  // fails, unless the cache has room again by then.
+  for (Worker* worker : evicted) {
+    {
+      std::lock_guard<std::mutex> lock(worker->mutex);
+      worker->job = std::make_shared<CachedThread::State>();
+      worker->job->function = [] {};
+    }
+    worker->cond.notify_one();
+  }
+}
+
+size_t ThreadCache::ParkedCount() {
+  Cache& cache = GetCache();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  return cache.parked.size();
+}
+
+void ThreadCache::DiscardCurrentThread() {
+  if (t_current_state != nullptr) {
+    t_discard_current = true;
+  }
+}
+
+}  // namespace bee
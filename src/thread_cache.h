@@ -0,0 +1,64 @@
+﻿#ifndef BEE_THREAD_CACHE_H
+#define BEE_THREAD_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <memory>
+
+namespace bee {
+
+// Handle of a function running on a thread of ThreadCache.
+class CachedThread {
+ public:
+  struct State;
+
+  explicit CachedThread(std::shared_ptr<State> state);
+  ~CachedThread();
+
+  // Wait until the function returns, the thread may be parked or running
+  // another function afterwards.
+  void Join();
+
+  // Stop tracking the function.
+  void Detach();
+
+  // Return if called from the function.
+  bool IsCurrent() const;
+
+ private:
+  CachedThread(const CachedThread&) = delete;
+  CachedThread& operator=(const CachedThread&) = delete;
+
+  std::shared_ptr<State> state_;
+};
+
+// Process wide cache of parked threads. A thread goes back to the cache
+// after its function returns, and the next Run() with the same stack size
+// adopts it instead of creating a thread, so starting and stopping
+// IOService per session costs no thread creation, and the stack and the
+// TaskNodePool cache of the thread stay warm.
+// Cached threads are never joined, they live until the process exits.
+class ThreadCache {
+ public:
+  // Run |function| on a parked thread with a stack of |stack_size| bytes, 0
+  // for default, or on a new thread if none is parked. Return nullptr if a
+  // thread can't be created.
+  static std::unique_ptr<CachedThread> Run(std::function<void()> function,
+                                           size_t stack_size);
+
+  // Set max number of parked threads, threads beyond it exit after their
+  // functions return, 0 disables the cache. 16 by default.
+  static void SetCapacity(size_t capacity);
+
+  // Return number of parked threads.
+  static size_t ParkedCount();
+
+  // Let the current thread exit after its function returns instead of being
+  // parked, e.g. its scheduling can't be reset. No-op on other threads.
+  static void DiscardCurrentThread();
+};
+
+}  // namespace bee
+
+#endif  // BEE_THREAD_CACHE_H
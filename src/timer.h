@@ -1,13 +1,16 @@
 ﻿#ifndef BEE_TIMER_H
 #define BEE_TIMER_H
 
-#include <functional>
+#include <stdint.h>
+
+#include "unique_function.h"
 
 namespace bee {
 
 class Timer {
  public:
-  typedef std::function<void(void)> TimerCallback;
+  // Move-only, so a callback may own its captures, e.g. unique_ptr.
+  typedef UniqueFunction<void(void)> TimerCallback;
   Timer() = default;
   virtual ~Timer() = default;
 
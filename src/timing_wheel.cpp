@@ -0,0 +1,318 @@
+﻿#include "timing_wheel.h"
+
+#include "bits.h"
+#include "io_service.h"
+#include "trace.h"
+
+namespace bee {
+
+namespace {
+
+const uint64_t kNoDeadline = UINT64_MAX;
+
+uint64_t RotateRight(uint64_t value, int32_t shift) {
+  return (shift == 0) ? value : ((value >> shift) | (value << (64 - shift)));
+}
+
+}  // namespace
+
+TimingWheel::TimingWheel(boost::asio::io_context* ioc,
+                         std::shared_ptr<TaskScheduler> scheduler)
+    : scheduler_(std::move(scheduler)),
+      timer_(*ioc),
+      start_time_(std::chrono::steady_clock::now()),
+      elapsed_(0),
+      armed_deadline_(kNoDeadline),
+      free_head_(kNil),
+      size_(0),
+      shutdown_(false) {
+  for (int32_t level = 0; level < kLevelCount; ++level) {
+    for (int32_t slot = 0; slot < kSlotCount; ++slot) {
+      heads_[level][slot] = kNil;
+      tails_[level][slot] = kNil;
+    }
+    occupied_[level] = 0;
+  }
+}
+
+TimingWheel::~TimingWheel() {
+  Shutdown();
+}
+
+void TimingWheel::Schedule(FunctorWrapper* task,
+                           int32_t delay,
+                           TaskHandle* handle) {
+  if (delay <= 0) {
+    scheduler_->Push(task);
+    return;
+  }
+
+  uint64_t now = NowTick(true);
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (shutdown_) {
+    lock.unlock();
+    task->discard();
+    return;
+  }
+
+  // Catch up with the clock while the wheel is empty. Otherwise the timer
+  // keeps the lag below the max delay, so that deadlines always fit in the
+  // span of the wheel.
+  if (size_ == 0 && now > elapsed_) {
+    elapsed_ = now;
+  }
+
+  uint32_t index = AllocateEntry();
+  Entry& entry = entries_[index];
+  entry.task = task;
+  entry.deadline = std::max(now, elapsed_) + static_cast<uint64_t>(delay);
+  Link(index);
+  ++size_;
+
+  if (entry.deadline < armed_deadline_) {
+    Arm(entry.deadline);
+  }
+
+  if (handle != nullptr) {
+    handle->BindWheel(shared_from_this(), index, entry.generation);
+  }
+}
+
+bool TimingWheel::Cancel(uint32_t index, uint32_t generation) {
+  FunctorWrapper* task = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (index >= entries_.size()) {
+      return false;
+    }
+    Entry& entry = entries_[index];
+    if (entry.task == nullptr || entry.generation != generation) {
+      return false;
+    }
+    task = entry.task;
+    Unlink(index);
+    FreeEntry(index);
+    --size_;
+  }
+
+  // Release the task out of lock, for its destructor may call back.
+  task->discard();
+  return true;
+}
+
+size_t TimingWheel::Size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return size_;
+}
+
+void TimingWheel::Shutdown() {
+  std::vector<FunctorWrapper*> tasks;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (shutdown_) {
+      return;
+    }
+    shutdown_ = true;
+
+    boost::system::error_code ec;
+    timer_.cancel(ec);
+
+    for (Entry& entry : entries_) {
+      if (entry.task != nullptr) {
+        tasks.push_back(entry.task);
+        entry.task = nullptr;
+      }
+    }
+    size_ = 0;
+  }
+
+  for (FunctorWrapper* task : tasks) {
+    task->discard();
+  }
+}
+
+uint64_t TimingWheel::NowTick(bool round_up) {
+  std::chrono::steady_clock::duration elapsed =
+      std::chrono::steady_clock::now() - start_time_;
+  std::chrono::milliseconds tick =
+      std::chrono::duration_cast<std::chrono::milliseconds>(elapsed);
+  if (round_up && tick < elapsed) {
+    tick += std::chrono::milliseconds(1);
+  }
+  return static_cast<uint64_t>(tick.count());
+}
+
+uint32_t TimingWheel::AllocateEntry() {
+  uint32_t index = free_head_;
+  if (index != kNil) {
+    free_head_ = entries_[index].next;
+  } else {
+    index = static_cast<uint32_t>(entries_.size());
+    Entry entry = {};
+    entries_.push_back(entry);
+  }
+  return index;
+}
+
+void TimingWheel::FreeEntry(uint32_t index) {
+  Entry& entry = entries_[index];
+  entry.task = nullptr;
+  // Invalidate handles of the entry.
+  ++entry.generation;
+  entry.next = free_head_;
+  free_head_ = index;
+}
+
+void TimingWheel::Link(uint32_t index) {
+  Entry& entry = entries_[index];
+  // Level where the deadline first differs from current tick.
+  uint64_t masked = (elapsed_ ^ entry.deadline) | (kSlotCount - 1);
+  int32_t level = std::min(HighestBit(masked) / kSlotBits, kLevelCount - 1);
+  int32_t slot =
+      static_cast<int32_t>(entry.deadline >> (level * kSlotBits)) &
+      (kSlotCount - 1);
+
+  entry.level = level;
+  entry.slot = slot;
+  entry.next = kNil;
+  entry.prev = tails_[level][slot];
+  if (entry.prev != kNil) {
+    entries_[entry.prev].next = index;
+  } else {
+    heads_[level][slot] = index;
+  }
+  tails_[level][slot] = index;
+  occupied_[level] |= (1ULL << slot);
+}
+
+void TimingWheel::Unlink(uint32_t index) {
+  Entry& entry = entries_[index];
+  int32_t level = entry.level;
+  int32_t slot = entry.slot;
+  if (entry.prev != kNil) {
+    entries_[entry.prev].next = entry.next;
+  } else {
+    heads_[level][slot] = entry.next;
+  }
+  if (entry.next != kNil) {
+    entries_[entry.next].prev = entry.prev;
+  } else {
+    tails_[level][slot] = entry.prev;
+  }
+  if (heads_[level][slot] == kNil) {
+    occupied_[level] &= ~(1ULL << slot);
+  }
+}
+
+bool TimingWheel::NextExpiration(uint64_t* deadline,
+                                 int32_t* level,
+                                 int32_t* slot) {
+  // Slots of a lower level always expire earlier than slots of a higher one.
+  for (int32_t i = 0; i < kLevelCount; ++i) {
+    if (occupied_[i] == 0) {
+      continue;
+    }
+
+    int32_t shift = i * kSlotBits;
+    uint64_t slot_range = 1ULL << shift;
+    uint64_t level_range = slot_range << kSlotBits;
+    int32_t now_slot = static_cast<int32_t>(elapsed_ >> shift) &
+                       (kSlotCount - 1);
+    int32_t next_slot =
+        (LowestBit(RotateRight(occupied_[i], now_slot)) + now_slot) &
+        (kSlotCount - 1);
+    uint64_t level_start = elapsed_ & ~(level_range - 1);
+    *deadline = level_start + next_slot * slot_range;
+    if (next_slot < now_slot) {
+      // Wrapped around to next round of the level.
+      *deadline += level_range;
+    }
+    *level = i;
+    *slot = next_slot;
+    return true;
+  }
+  return false;
+}
+
+void TimingWheel::Advance(uint64_t now,
+                          FunctorWrapper** head,
+                          FunctorWrapper** tail,
+                          size_t* count) {
+  uint64_t deadline = 0;
+  int32_t level = 0;
+  int32_t slot = 0;
+  while (NextExpiration(&deadline, &level, &slot) && deadline <= now) {
+    elapsed_ = deadline;
+
+    // Take the slot, fire the expired entries and move the others down.
+    uint32_t index = heads_[level][slot];
+    heads_[level][slot] = kNil;
+    tails_[level][slot] = kNil;
+    occupied_[level] &= ~(1ULL << slot);
+    while (index != kNil) {
+      Entry& entry = entries_[index];
+      uint32_t next = entry.next;
+      if (entry.deadline <= elapsed_) {
+        FunctorWrapper* task = entry.task;
+        task->next_ = nullptr;
+        if (*tail != nullptr) {
+          (*tail)->next_ = task;
+        } else {
+          *head = task;
+        }
+        *tail = task;
+        ++*count;
+        FreeEntry(index);
+        --size_;
+      } else {
+        Link(index);
+      }
+      index = next;
+    }
+  }
+
+  if (now > elapsed_) {
+    elapsed_ = now;
+  }
+}
+
+void TimingWheel::Arm(uint64_t deadline) {
+  armed_deadline_ = deadline;
+  // Resetting expiry cancels the pending wait, whose handler sees
+  // operation_aborted.
+  timer_.expires_at(start_time_ + std::chrono::milliseconds(deadline));
+  timer_.async_wait(TimerHandler(shared_from_this()));
+}
+
+void TimingWheel::OnTimer(const boost::system::error_code& ec) {
+  if (ec == boost::asio::error::operation_aborted) {
+    return;
+  }
+
+  BEE_TRACE_SCOPE("timer", "TimingWheel::OnTimer");
+  FunctorWrapper* head = nullptr;
+  FunctorWrapper* tail = nullptr;
+  size_t count = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (shutdown_) {
+      return;
+    }
+
+    armed_deadline_ = kNoDeadline;
+    Advance(NowTick(false), &head, &tail, &count);
+
+    uint64_t deadline = 0;
+    int32_t level = 0;
+    int32_t slot = 0;
+    if (NextExpiration(&deadline, &level, &slot)) {
+      Arm(deadline);
+    }
+  }
+
+  if (count > 0) {
+    scheduler_->PushBatch(head, tail, count);
+  }
+}
+
+}  // namespace bee
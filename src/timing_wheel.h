@@ -0,0 +1,123 @@
+﻿#ifndef BEE_TIMING_WHEEL_H
+#define BEE_TIMING_WHEEL_H
+
+#include <stdint.h>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "boost/asio/io_context.hpp"
+#include "boost/asio/steady_timer.hpp"
+#include "task_handle.h"
+#include "task_node_pool.h"
+
+namespace bee {
+
+class FunctorWrapper;
+class TaskScheduler;
+
+// Hierarchical timing wheel of delayed tasks, driven by a single asio timer.
+// There are kLevelCount levels of kSlotCount slots, a slot of level 0 spans
+// one millisecond tick and a slot of level N spans kSlotCount^N ticks. A task
+// is linked into the level where its deadline first differs from current
+// tick, and moved down level by level when time reaches its slot, so insert
+// and cancel are O(1) and firing costs O(1) amortized per task.
+// Entries live in a slab indexed by TaskHandle, with a generation to detect
+// stale handles. The asio timer is only armed for the nearest slot, so an idle
+// wheel never wakes up.
+class TimingWheel : public std::enable_shared_from_this<TimingWheel> {
+ public:
+  TimingWheel(boost::asio::io_context* ioc,
+              std::shared_ptr<TaskScheduler> scheduler);
+  ~TimingWheel();
+
+ public:
+  // Push |task| to scheduler after |delay| milliseconds from any thread, take
+  // ownership of |task|. If |handle| is not nullptr, it is bound to the entry
+  // of the task, so that it cancels the task before it's fired.
+  void Schedule(FunctorWrapper* task, int32_t delay, TaskHandle* handle);
+
+  // Cancel the task of entry |index| if it's still of |generation|.
+  bool Cancel(uint32_t index, uint32_t generation);
+
+  // Return number of pending tasks.
+  size_t Size();
+
+  // Stop firing, tasks left are deleted without running.
+  void Shutdown();
+
+ private:
+  static const int32_t kLevelCount = 6;
+  static const int32_t kSlotBits = 6;
+  static const int32_t kSlotCount = 1 << kSlotBits;
+  static const uint32_t kNil = 0xFFFFFFFF;
+
+  struct Entry {
+    // Task of the entry, nullptr if the entry is free.
+    FunctorWrapper* task;
+    uint64_t deadline;
+    uint32_t prev;
+    uint32_t next;
+    uint32_t generation;
+    int32_t level;
+    int32_t slot;
+  };
+
+  // Timer handler allocated from TaskNodePool, holds the wheel weakly so
+  // that pending handlers never keep it alive.
+  class TimerHandler {
+   public:
+    typedef TaskNodeAllocator<void> allocator_type;
+
+    explicit TimerHandler(std::weak_ptr<TimingWheel> wheel)
+        : wheel_(std::move(wheel)) {}
+
+    allocator_type get_allocator() const { return allocator_type(); }
+
+    void operator()(const boost::system::error_code& ec) {
+      std::shared_ptr<TimingWheel> wheel = wheel_.lock();
+      if (wheel != nullptr) {
+        wheel->OnTimer(ec);
+      }
+    }
+
+   private:
+    std::weak_ptr<TimingWheel> wheel_;
+  };
+
+  uint64_t NowTick(bool round_up);
+  uint32_t AllocateEntry();
+  void FreeEntry(uint32_t index);
+  void Link(uint32_t index);
+  void Unlink(uint32_t index);
+  bool NextExpiration(uint64_t* deadline, int32_t* level, int32_t* slot);
+  void Advance(uint64_t now,
+               FunctorWrapper** head,
+               FunctorWrapper** tail,
+               size_t* count);
+  void Arm(uint64_t deadline);
+  void OnTimer(const boost::system::error_code& ec);
+
+ private:
+  std::shared_ptr<TaskScheduler> scheduler_;
+  std::mutex mutex_;
+  boost::asio::steady_timer timer_;
+  const std::chrono::steady_clock::time_point start_time_;
+  // Current tick of the wheel, all entries have later deadlines.
+  uint64_t elapsed_;
+  // Deadline the timer is armed for, kNoDeadline if not armed.
+  uint64_t armed_deadline_;
+  std::vector<Entry> entries_;
+  uint32_t free_head_;
+  uint32_t heads_[kLevelCount][kSlotCount];
+  uint32_t tails_[kLevelCount][kSlotCount];
+  // Bitmap of non-empty slots of each level.
+  uint64_t occupied_[kLevelCount];
+  size_t size_;
+  bool shutdown_;
+};
+
+}  // namespace bee
+
+#endif  // BEE_TIMING_WHEEL_H
@@ -0,0 +1,395 @@
+﻿#include "trace.h"
+
+#include <stdio.h>
+
+#if defined(BEE_ENABLE_TRACE)
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#endif
+
+namespace bee {
+
+#if defined(BEE_ENABLE_TRACE)
+
+namespace trace_internal {
+
+std::atomic<bool> g_recording(false);
+
+}  // namespace trace_internal
+
+namespace {
+
+// Event slot of a ring buffer, a seqlock of relaxed atomic fields, so that a
+// dump may read it while the owner overwrites it.
+struct TraceSlot {
+  // 2 * index + 2 of the event in the slot, odd while it's being written.
+  std::atomic<uint64_t> sequence;
+  std::atomic<const char*> category;
+  std::atomic<const char*> name;
+  std::atomic<const char*> file;
+  std::atomic<int32_t> line;
+  std::atomic<int64_t> timestamp;
+  std::atomic<int64_t> duration;
+  std::atomic<uint64_t> id;
+  std::atomic<char> phase;
+};
+
+// Ring buffer of one thread. Only the owner writes events, publishing them
+// by |count|, a dump copies them and drops the ones overwritten meanwhile.
+struct TraceBuffer {
+  // Start() the buffer is recorded in, stale buffers are reset by owners.
+  uint32_t generation = 0;
+  std::unique_ptr<TraceSlot[]> slots;
+  size_t capacity = 0;
+  // Events ever recorded since reset.
+  std::atomic<uint64_t> count{0};
+  int64_t tid = 0;
+  std::string thread_name;
+  bool exited = false;
+};
+
+// Registry of buffers, also guards resetting and dumping a buffer.
+std::mutex& RegistryMutex() {
+  static std::mutex* mutex = new std::mutex;
+  return *mutex;
+}
+
+std::vector<TraceBuffer*>& Buffers() {
+  static std::vector<TraceBuffer*>* buffers = new std::vector<TraceBuffer*>;
+  return *buffers;
+}
+
+std::atomic<uint32_t> g_generation(0);
+size_t g_events_per_thread = TraceLog::kDefaultEventsPerThread;
+
+thread_local TraceBuffer* t_buffer = nullptr;
+
+// Keep the buffer of an exited thread for dumping, it's deleted on next
+// Start().
+struct TraceBufferHolder {
+  ~TraceBufferHolder() {
+    if (t_buffer != nullptr) {
+      std::lock_guard<std::mutex> lock(RegistryMutex());
+      t_buffer->exited = true;
+      t_buffer = nullptr;
+    }
+  }
+  bool attached = false;
+};
+
+thread_local TraceBufferHolder t_holder;
+
+int64_t CurrentThreadId() {
+#if defined(_WIN32)
+  return static_cast<int64_t>(GetCurrentThreadId());
+#elif defined(__linux__)
+  return static_cast<int64_t>(syscall(SYS_gettid));
+#else
+  static std::atomic<int64_t> next_id(1);
+  return next_id.fetch_add(1);
+#endif
+}
+
+std::string CurrentThreadName() {
+#if defined(__linux__)
+  char name[16] = {0};
+  if (pthread_getname_np(pthread_self(), name, sizeof(name)) == 0) {
+    return name;
+  }
+#endif
+  return std::string();
+}
+
+// Return buffer of current thread for current Start(), reset if stale. The
+// thread name is read again on reset, for a thread from ThreadCache may be
+// renamed by another IOService.
+TraceBuffer* LocalBuffer() {
+  uint32_t generation = g_generation.load(std::memory_order_acquire);
+  TraceBuffer* buffer = t_buffer;
+  if (buffer != nullptr && buffer->generation == generation) {
+    return buffer;
+  }
+
+  std::lock_guard<std::mutex> lock(RegistryMutex());
+  if (buffer == nullptr) {
+    buffer = new TraceBuffer;
+    buffer->tid = CurrentThreadId();
+    Buffers().push_back(buffer);
+    t_buffer = buffer;
+    t_holder.attached = true;
+  }
+  buffer->thread_name = CurrentThreadName();
+  if (buffer->capacity != g_events_per_thread) {
+    buffer->capacity = g_events_per_thread;
+    buffer->slots.reset(new TraceSlot[buffer->capacity]());
+  }
+  buffer->count.store(0, std::memory_order_relaxed);
+  buffer->generation = g_generation.load(std::memory_order_relaxed);
+  return buffer;
+}
+
+void AppendEscaped(std::string* out, const char* text) {
+  for (; *text != '\0'; ++text) {
+    if (*text == '"' || *text == '\\') {
+      out->push_back('\\');
+    }
+    if (static_cast<unsigned char>(*text) >= 0x20) {
+      out->push_back(*text);
+    }
+  }
+}
+
+void AppendEvent(std::string* out,
+                 const TraceEvent& event,
+                 int64_t tid,
+                 int64_t base) {
+  char buffer[128];
+  out->append("{\"ph\":\"");
+  out->push_back(event.phase);
+  out->append("\",\"cat\":\"");
+  AppendEscaped(out, event.category);
+  out->append("\",\"name\":\"");
+  AppendEscaped(out, event.name);
+  // Timestamps are in microseconds.
+  snprintf(buffer, sizeof(buffer), "\",\"pid\":1,\"tid\":%lld,\"ts\":%.3f",
+           static_cast<long long>(tid), (event.timestamp - base) / 1000.0);
+  out->append(buffer);
+  switch (event.phase) {
+    case TRACE_PHASE_COMPLETE:
+      snprintf(buffer, sizeof(buffer), ",\"dur\":%.3f",
+               event.duration / 1000.0);
+      out->append(buffer);
+      break;
+    case TRACE_PHASE_INSTANT:
+      out->append(",\"s\":\"t\"");
+      break;
+    case TRACE_PHASE_FLOW_END:
+      // Bind to the enclosing slice, which starts at the same time.
+      out->append(",\"bp\":\"e\"");
+      // Fall through.
+    default:
+      snprintf(buffer, sizeof(buffer), ",\"id\":\"0x%llx\"",
+               static_cast<unsigned long long>(event.id));
+      out->append(buffer);
+      break;
+  }
+  if (event.location.File() != nullptr) {
+    out->append(",\"args\":{\"src\":\"");
+    AppendEscaped(out, event.location.File());
+    snprintf(buffer, sizeof(buffer), ":%d\"}", event.location.Line());
+    out->append(buffer);
+  }
+  out->append("}");
+}
+
+}  // namespace
+
+namespace trace_internal {
+
+int64_t NowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void Record(const TraceEvent& event) {
+  TraceBuffer* buffer = LocalBuffer();
+  uint64_t count = buffer->count.load(std::memory_order_relaxed);
+  TraceSlot& slot = buffer->slots[count % buffer->capacity];
+  slot.sequence.store(count * 2 + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.category.store(event.category, std::memory_order_relaxed);
+  slot.name.store(event.name, std::memory_order_relaxed);
+  slot.file.store(event.location.File(), std::memory_order_relaxed);
+  slot.line.store(event.location.Line(), std::memory_order_relaxed);
+  slot.timestamp.store(event.timestamp, std::memory_order_relaxed);
+  slot.duration.store(event.duration, std::memory_order_relaxed);
+  slot.id.store(event.id, std::memory_order_relaxed);
+  slot.phase.store(event.phase, std::memory_order_relaxed);
+  slot.sequence.store(count * 2 + 2, std::memory_order_release);
+  buffer->count.store(count + 1, std::memory_order_release);
+}
+
+void Record(char phase,
+            const char* category,
+            const char* name,
+            uint64_t id,
+            const Location& location) {
+  TraceEvent event;
+  event.category = category;
+  event.name = name;
+  event.location = location;
+  event.timestamp = NowNanos();
+  event.duration = 0;
+  event.id = id;
+  event.phase = phase;
+  Record(event);
+}
+
+void ScopedEvent::End() {
+  TraceEvent event;
+  event.category = category_;
+  event.name = name_;
+  event.location = location_;
+  event.timestamp = start_;
+  event.duration = NowNanos() - start_;
+  event.id = 0;
+  event.phase = TRACE_PHASE_COMPLETE;
+  Record(event);
+  if (flow_id_ != 0) {
+    event.location = Location();
+    event.duration = 0;
+    event.id = flow_id_;
+    event.phase = TRACE_PHASE_FLOW_END;
+    Record(event);
+  }
+}
+
+}  // namespace trace_internal
+
+bool TraceLog::Start(size_t events_per_thread) {
+  std::lock_guard<std::mutex> lock(RegistryMutex());
+  std::vector<TraceBuffer*>& buffers = Buffers();
+  for (size_t i = 0; i < buffers.size();) {
+    if (buffers[i]->exited) {
+      delete buffers[i];
+      buffers[i] = buffers.back();
+      buffers.pop_back();
+    } else {
+      ++i;
+    }
+  }
+  g_events_per_thread = events_per_thread;
+  if (g_events_per_thread == 0) {
+    g_events_per_thread = kDefaultEventsPerThread;
+  }
+  g_generation.fetch_add(1, std::memory_order_release);
+  trace_internal::g_recording.store(true, std::memory_order_relaxed);
+  return true;
+}
+
+void TraceLog::Stop() {
+  trace_internal::g_recording.store(false, std::memory_order_relaxed);
+}
+
+bool TraceLog::IsRecording() {
+  return trace_internal::IsRecording();
+}
+
+bool TraceLog::WriteChromeTrace(const std::string& path) {
+  struct ThreadEvents {
+    int64_t tid;
+    std::string name;
+    std::vector<TraceEvent> events;
+  };
+  std::vector<ThreadEvents> threads;
+  int64_t base = std::numeric_limits<int64_t>::max();
+  {
+    std::lock_guard<std::mutex> lock(RegistryMutex());
+    uint32_t generation = g_generation.load(std::memory_order_relaxed);
+    for (TraceBuffer* buffer : Buffers()) {
+      if (buffer->generation != generation) {
+        continue;
+      }
+      // Copy each slot, and drop it if the owner is writing or has
+      // overwritten it meanwhile.
+      uint64_t end = buffer->count.load(std::memory_order_acquire);
+      uint64_t begin = (end > buffer->capacity) ? end - buffer->capacity : 0;
+      std::vector<TraceEvent> events;
+      events.reserve(static_cast<size_t>(end - begin));
+      for (uint64_t i = begin; i < end; ++i) {
+        const TraceSlot& slot = buffer->slots[i % buffer->capacity];
+        uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence != i * 2 + 2) {
+          continue;
+        }
+        TraceEvent event;
+        event.category = slot.category.load(std::memory_order_relaxed);
+        event.name = slot.name.load(std::memory_order_relaxed);
+        event.location =
+            Location(slot.file.load(std::memory_order_relaxed),
+                     slot.line.load(std::memory_order_relaxed));
+        event.timestamp = slot.timestamp.load(std::memory_order_relaxed);
+        event.duration = slot.duration.load(std::memory_order_relaxed);
+        event.id = slot.id.load(std::memory_order_relaxed);
+        event.phase = slot.phase.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) != sequence) {
+          continue;
+        }
+        base = (std::min)(base, event.timestamp);
+        events.push_back(event);
+      }
+      ThreadEvents thread = {buffer->tid, buffer->thread_name,
+                             std::vector<TraceEvent>()};
+      thread.events.swap(events);
+      threads.push_back(std::move(thread));
+    }
+  }
+
+  std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  bool first = true;
+  char buffer[128];
+  for (const ThreadEvents& thread : threads) {
+    if (!thread.name.empty()) {
+      out.append(first ? "\n" : ",\n");
+      first = false;
+      snprintf(buffer, sizeof(buffer),
+               "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,"
+               "\"tid\":%lld,\"args\":{\"name\":\"",
+               static_cast<long long>(thread.tid));
+      out.append(buffer);
+      AppendEscaped(&out, thread.name.c_str());
+      out.append("\"}}");
+    }
+    for (const TraceEvent& event : thread.events) {
+      out.append(first ? "\n" : ",\n");
+      first = false;
+      AppendEvent(&out, event, thread.tid, base);
+    }
+  }
+  out.append("\n]}\n");
+
+  FILE* file = fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    printf("Open trace file %s failed\n", path.c_str());
+    return false;
+  }
+  bool result = (fwrite(out.data(), 1, out.size(), file) == out.size());
+  fclose(file);
+  return result;
+}
+
+#else  // BEE_ENABLE_TRACE
+
+bool TraceLog::Start(size_t events_per_thread) {
+  return false;
+}
+
+void TraceLog::Stop() {}
+
+bool TraceLog::IsRecording() {
+  return false;
+}
+
+bool TraceLog::WriteChromeTrace(const std::string& path) {
+  return false;
+}
+
+#endif  // BEE_ENABLE_TRACE
+
+}  // namespace bee
@@ -0,0 +1,187 @@
+﻿#ifndef BEE_TRACE_H
+#define BEE_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+#include "location.h"
+
+namespace bee {
+
+// Timeline tracing of IOService threads, dumped as Chrome trace JSON, which
+// chrome://tracing and ui.perfetto.dev open directly.
+// Tracing is compiled in only with BEE_ENABLE_TRACE defined, otherwise the
+// BEE_TRACE_* macros expand to nothing and TraceLog does nothing. When
+// compiled in but not recording, an event costs a relaxed load.
+// Every thread records to its own ring buffer of fixed size without locks,
+// so the oldest events are overwritten when a buffer is full. Names and
+// categories must be string literals, only pointers are recorded.
+class TraceLog {
+ public:
+  // Start recording with ring buffers of |events_per_thread| events, discard
+  // events recorded before. Return false if tracing is compiled out.
+  static bool Start(size_t events_per_thread = kDefaultEventsPerThread);
+
+  // Stop recording, recorded events are kept for dumping.
+  static void Stop();
+
+  // Return if recording.
+  static bool IsRecording();
+
+  // Write recorded events of all threads to |path| as Chrome trace JSON,
+  // including threads exited since Start(). It may be called while
+  // recording, events overwritten during the dump are left out.
+  static bool WriteChromeTrace(const std::string& path);
+
+  static const size_t kDefaultEventsPerThread = 32768;
+};
+
+}  // namespace bee
+
+#if defined(BEE_ENABLE_TRACE)
+
+namespace bee {
+
+// Phases of Chrome trace event format.
+enum TracePhase {
+  TRACE_PHASE_COMPLETE = 'X',
+  TRACE_PHASE_INSTANT = 'i',
+  TRACE_PHASE_ASYNC_BEGIN = 'b',
+  TRACE_PHASE_ASYNC_END = 'e',
+  TRACE_PHASE_FLOW_START = 's',
+  TRACE_PHASE_FLOW_END = 'f'
+};
+
+struct TraceEvent {
+  const char* category;
+  const char* name;
+  // Where the traced work comes from, e.g. where a task is posted.
+  Location location;
+  int64_t timestamp;
+  // Duration of complete events in nanoseconds.
+  int64_t duration;
+  // Id of async and flow events, matching begin and end.
+  uint64_t id;
+  char phase;
+};
+
+namespace trace_internal {
+
+extern std::atomic<bool> g_recording;
+
+inline bool IsRecording() {
+  return g_recording.load(std::memory_order_relaxed);
+}
+
+int64_t NowNanos();
+
+inline uint64_t TraceId(const void* id) {
+  return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(id));
+}
+
+inline uint64_t TraceId(uint64_t id) {
+  return id;
+}
+
+// Record |event| to the ring buffer of current thread.
+void Record(const TraceEvent& event);
+
+void Record(char phase,
+            const char* category,
+            const char* name,
+            uint64_t id,
+            const Location& location = Location());
+
+// Record a complete event from construction to destruction, and optionally
+// the end of flow |id| bound to it.
+class ScopedEvent {
+ public:
+  ScopedEvent(const char* category,
+              const char* name,
+              const Location& location = Location(),
+              const void* flow_id = nullptr)
+      : category_(category),
+        name_(name),
+        location_(location),
+        flow_id_(TraceId(flow_id)),
+        start_(IsRecording() ? NowNanos() : 0) {}
+
+  ~ScopedEvent() {
+    if (start_ != 0 && IsRecording()) {
+      End();
+    }
+  }
+
+ private:
+  ScopedEvent(const ScopedEvent&) = delete;
+  ScopedEvent& operator=(const ScopedEvent&) = delete;
+
+  void End();
+
+  const char* category_;
+  const char* name_;
+  Location location_;
+  uint64_t flow_id_;
+  int64_t start_;
+};
+
+}  // namespace trace_internal
+
+}  // namespace bee
+
+#define BEE_TRACE_CONCAT_INNER(a, b) a##b
+#define BEE_TRACE_CONCAT(a, b) BEE_TRACE_CONCAT_INNER(a, b)
+
+#define BEE_TRACE_EVENT(phase, category, name, id, location)            \
+  do {                                                                  \
+    if (::bee::trace_internal::IsRecording()) {                         \
+      ::bee::trace_internal::Record(                                    \
+          phase, category, name, ::bee::trace_internal::TraceId(id),    \
+          location);                                                    \
+    }                                                                   \
+  } while (0)
+
+// Span of current scope.
+#define BEE_TRACE_SCOPE(category, name)                                 \
+  ::bee::trace_internal::ScopedEvent BEE_TRACE_CONCAT(bee_trace_scope_, \
+                                                      __LINE__)(category, name)
+
+// Span of current scope, ending the flow started with |id| and labeled
+// with |location|, e.g. a task run linked to where it's posted.
+#define BEE_TRACE_FLOW_SCOPE(category, name, id, location)             \
+  ::bee::trace_internal::ScopedEvent BEE_TRACE_CONCAT(                 \
+      bee_trace_scope_, __LINE__)(category, name, location, id)
+
+// Start of a flow ended by BEE_TRACE_FLOW_SCOPE() with the same |category|,
+// |name| and |id|, usually a pointer, which may be on another thread.
+#define BEE_TRACE_FLOW_START(category, name, id)                        \
+  BEE_TRACE_EVENT(::bee::TRACE_PHASE_FLOW_START, category, name, id,    \
+                  ::bee::Location())
+
+#define BEE_TRACE_INSTANT(category, name)                               \
+  BEE_TRACE_EVENT(::bee::TRACE_PHASE_INSTANT, category, name, nullptr,  \
+                  ::bee::Location())
+
+// Span across callbacks, such as an async operation and its completion,
+// matched by |category|, |name| and |id|.
+#define BEE_TRACE_ASYNC_BEGIN(category, name, id)                       \
+  BEE_TRACE_EVENT(::bee::TRACE_PHASE_ASYNC_BEGIN, category, name, id,   \
+                  ::bee::Location())
+#define BEE_TRACE_ASYNC_END(category, name, id)                         \
+  BEE_TRACE_EVENT(::bee::TRACE_PHASE_ASYNC_END, category, name, id,     \
+                  ::bee::Location())
+
+#else  // BEE_ENABLE_TRACE
+
+#define BEE_TRACE_SCOPE(category, name)
+#define BEE_TRACE_FLOW_SCOPE(category, name, id, location)
+#define BEE_TRACE_FLOW_START(category, name, id)
+#define BEE_TRACE_INSTANT(category, name)
+#define BEE_TRACE_ASYNC_BEGIN(category, name, id)
+#define BEE_TRACE_ASYNC_END(category, name, id)
+
+#endif  // BEE_ENABLE_TRACE
+
+#endif  // BEE_TRACE_H
@@ -0,0 +1,242 @@
+﻿#ifndef BEE_UNIQUE_FUNCTION_H
+#define BEE_UNIQUE_FUNCTION_H
+
+#include <stddef.h>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "task_node_pool.h"
+
+namespace bee {
+
+// Default inline buffer size of UniqueFunction, enough for a lambda capturing
+// a shared_ptr and two pointers.
+const size_t kUniqueFunctionInlineSize = 4 * sizeof(void*);
+
+namespace function_internal {
+
+// Implementation of UniqueFunction and InplaceFunction, which differ only in
+// whether a callable not fitting inline is allowed on heap.
+template <typename T, size_t InlineSize, bool AllowHeap>
+class MoveOnlyFunction;  // Undefined.
+
+template <typename RetT, typename... ArgT, size_t InlineSize, bool AllowHeap>
+class MoveOnlyFunction<RetT(ArgT...), InlineSize, AllowHeap> final {
+ public:
+  MoveOnlyFunction() : ops_(nullptr) {}
+
+  MoveOnlyFunction(std::nullptr_t) : ops_(nullptr) {}
+
+  // Constructor for lambdas, function pointers and other callables, a null
+  // function pointer makes an empty function.
+  template <typename F,
+            typename std::enable_if<
+                !std::is_same<MoveOnlyFunction, typename std::decay<F>::type>::
+                    value &&
+                !std::is_same<std::nullptr_t,
+                              typename std::decay<F>::type>::value>::type* =
+                nullptr>
+  MoveOnlyFunction(F&& f) : ops_(nullptr) {
+    typedef typename std::decay<F>::type Callable;
+    static_assert(AllowHeap || IsInline<Callable>::value,
+                  "Callable of InplaceFunction must fit in its capacity, not "
+                  "be over aligned, and be nothrow movable");
+    if (!IsNull(f)) {
+      Construct<Callable>(std::forward<F>(f), IsInline<Callable>());
+    }
+  }
+
+  MoveOnlyFunction(MoveOnlyFunction&& other) : ops_(nullptr) {
+    MoveFrom(other);
+  }
+
+  ~MoveOnlyFunction() { Reset(); }
+
+  MoveOnlyFunction& operator=(MoveOnlyFunction&& other) {
+    if (this != &other) {
+      Reset();
+      MoveFrom(other);
+    }
+    return *this;
+  }
+
+  MoveOnlyFunction& operator=(std::nullptr_t) {
+    Reset();
+    return *this;
+  }
+
+  template <typename F,
+            typename std::enable_if<
+                !std::is_same<MoveOnlyFunction, typename std::decay<F>::type>::
+                    value &&
+                !std::is_same<std::nullptr_t,
+                              typename std::decay<F>::type>::value>::type* =
+                nullptr>
+  MoveOnlyFunction& operator=(F&& f) {
+    MoveOnlyFunction function(std::forward<F>(f));
+    return *this = std::move(function);
+  }
+
+  // Call the callable, which must not be empty. Like std::function, it may
+  // modify the state of the callable though it's const.
+  RetT operator()(ArgT... args) const {
+    return ops_->invoke(const_cast<Storage*>(&storage_),
+                        std::forward<ArgT>(args)...);
+  }
+
+  // Returns true if we have a callable, false if we don't.
+  explicit operator bool() const { return ops_ != nullptr; }
+
+ private:
+  MoveOnlyFunction(const MoveOnlyFunction&) = delete;
+  MoveOnlyFunction& operator=(const MoveOnlyFunction&) = delete;
+
+  union Storage {
+    typename std::aligned_storage<InlineSize,
+                                  alignof(std::max_align_t)>::type buffer;
+    void* heap;
+  };
+
+  // Type erased operations of the stored callable.
+  struct Ops {
+    RetT (*invoke)(Storage* storage, ArgT&&... args);
+    // Move the callable from |from| to |to| and destroy |from|.
+    void (*relocate)(Storage* to, Storage* from);
+    void (*destroy)(Storage* storage);
+  };
+
+  template <typename Callable>
+  struct IsInline
+      : std::integral_constant<
+            bool,
+            sizeof(Callable) <= sizeof(Storage) &&
+                alignof(Callable) <= alignof(Storage) &&
+                std::is_nothrow_move_constructible<Callable>::value> {};
+
+  template <typename Callable>
+  struct InlineOps {
+    static Callable* Get(Storage* storage) {
+      return reinterpret_cast<Callable*>(&storage->buffer);
+    }
+    static RetT Invoke(Storage* storage, ArgT&&... args) {
+      return (*Get(storage))(std::forward<ArgT>(args)...);
+    }
+    static void Relocate(Storage* to, Storage* from) {
+      new (&to->buffer) Callable(std::move(*Get(from)));
+      Get(from)->~Callable();
+    }
+    static void Destroy(Storage* storage) { Get(storage)->~Callable(); }
+    static const Ops kOps;
+  };
+
+  template <typename Callable>
+  struct HeapOps {
+    static Callable* Get(Storage* storage) {
+      return static_cast<Callable*>(storage->heap);
+    }
+    static RetT Invoke(Storage* storage, ArgT&&... args) {
+      return (*Get(storage))(std::forward<ArgT>(args)...);
+    }
+    static void Relocate(Storage* to, Storage* from) {
+      to->heap = from->heap;
+      from->heap = nullptr;
+    }
+    static void Destroy(Storage* storage) {
+      Get(storage)->~Callable();
+      TaskNodePool::Free(storage->heap);
+    }
+    static const Ops kOps;
+  };
+
+  template <typename F>
+  static bool IsNull(const F& f) {
+    return IsNullPointer(f, std::is_pointer<F>());
+  }
+
+  template <typename F>
+  static bool IsNullPointer(const F& f, std::true_type) {
+    return f == nullptr;
+  }
+
+  template <typename F>
+  static bool IsNullPointer(const F&, std::false_type) {
+    return false;
+  }
+
+  template <typename Callable, typename F>
+  void Construct(F&& f, std::true_type) {
+    new (&storage_.buffer) Callable(std::forward<F>(f));
+    ops_ = &InlineOps<Callable>::kOps;
+  }
+
+  template <typename Callable, typename F>
+  void Construct(F&& f, std::false_type) {
+    void* p = TaskNodePool::Allocate(sizeof(Callable));
+    new (p) Callable(std::forward<F>(f));
+    storage_.heap = p;
+    ops_ = &HeapOps<Callable>::kOps;
+  }
+
+  void MoveFrom(MoveOnlyFunction& other) {
+    if (other.ops_ != nullptr) {
+      other.ops_->relocate(&storage_, &other.storage_);
+      ops_ = other.ops_;
+      other.ops_ = nullptr;
+    }
+  }
+
+  void Reset() {
+    if (ops_ != nullptr) {
+      ops_->destroy(&storage_);
+      ops_ = nullptr;
+    }
+  }
+
+  Storage storage_;
+  // Operations of the stored callable, nullptr if empty.
+  const Ops* ops_;
+};
+
+template <typename RetT, typename... ArgT, size_t InlineSize, bool AllowHeap>
+template <typename Callable>
+const typename MoveOnlyFunction<RetT(ArgT...), InlineSize, AllowHeap>::Ops
+    MoveOnlyFunction<RetT(ArgT...), InlineSize, AllowHeap>::InlineOps<
+        Callable>::kOps = {&InlineOps<Callable>::Invoke,
+                           &InlineOps<Callable>::Relocate,
+                           &InlineOps<Callable>::Destroy};
+
+template <typename RetT, typename... ArgT, size_t InlineSize, bool AllowHeap>
+template <typename Callable>
+const typename MoveOnlyFunction<RetT(ArgT...), InlineSize, AllowHeap>::Ops
+    MoveOnlyFunction<RetT(ArgT...), InlineSize, AllowHeap>::HeapOps<
+        Callable>::kOps = {&HeapOps<Callable>::Invoke,
+                           &HeapOps<Callable>::Relocate,
+                           &HeapOps<Callable>::Destroy};
+
+}  // namespace function_internal
+
+// Move-only counterpart of std::function. Since it's never copied, it accepts
+// move-only callables, e.g. lambdas capturing unique_ptr, and a callable is
+// moved in and out without any copy.
+// A callable up to |InlineSize| bytes which is nothrow move constructible is
+// stored inline, otherwise it's allocated from TaskNodePool.
+//
+// Example use, a C++11 lambda can't capture by move, so a functor holds the
+// unique_ptr instead:
+//
+//   struct SendBuffer {
+//     std::unique_ptr<Buffer> buffer;
+//     void operator()() { ... }
+//   };
+//
+//   std::unique_ptr<Buffer> buffer = ...;
+//   UniqueFunction<void()> function = SendBuffer{std::move(buffer)};
+//   io_service->ExecuteFunction(std::move(function));
+template <typename T, size_t InlineSize = kUniqueFunctionInlineSize>
+using UniqueFunction = function_internal::MoveOnlyFunction<T, InlineSize, true>;
+
+}  // namespace bee
+
+#endif  // BEE_UNIQUE_FUNCTION_H
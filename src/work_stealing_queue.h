@@ -0,0 +1,119 @@
+﻿#ifndef BEE_WORK_STEALING_QUEUE_H
+#define BEE_WORK_STEALING_QUEUE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace bee {
+
+// Chase-Lev work stealing deque, following "Correct and Efficient
+// Work-Stealing for Weak Memory Models" (Le et al., PPoPP 2013).
+// Only the owner thread may Push(), any thread may Steal(). The owner takes
+// elements through Steal() as well, so elements are consumed in FIFO order,
+// which keeps the posting order of tasks from one thread.
+template <class T>
+class WorkStealingQueue {
+ public:
+  // |capacity| must be power of 2, the queue grows when it is full.
+  explicit WorkStealingQueue(int64_t capacity = 256)
+      : top_(0), bottom_(0), array_(new Array(capacity)) {
+    arrays_.emplace_back(array_.load(std::memory_order_relaxed));
+  }
+
+  ~WorkStealingQueue() = default;
+
+  // Push an element to the bottom, owner thread only.
+  void Push(T* item) {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_acquire);
+    Array* a = array_.load(std::memory_order_relaxed);
+    if (b - t > a->Capacity() - 1) {
+      // Old arrays are retired but kept alive, for thieves may still read
+      // them.
+      a = a->Grow(b, t);
+      arrays_.emplace_back(a);
+      array_.store(a, std::memory_order_release);
+    }
+    a->Put(b, item);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+
+  // Take an element from the top, return nullptr if the queue is empty.
+  T* Steal() {
+    while (true) {
+      int64_t t = top_.load(std::memory_order_acquire);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      int64_t b = bottom_.load(std::memory_order_acquire);
+      if (t >= b) {
+        return nullptr;
+      }
+      Array* a = array_.load(std::memory_order_acquire);
+      T* item = a->Get(t);
+      if (top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                       std::memory_order_relaxed)) {
+        return item;
+      }
+      // Lost the race to another thief, try again.
+    }
+  }
+
+  // Return if the queue is empty, the result may be stale at once.
+  bool Empty() const { return Size() <= 0; }
+
+  // Return number of elements, the result may be stale at once.
+  int64_t Size() const {
+    int64_t b = bottom_.load(std::memory_order_acquire);
+    int64_t t = top_.load(std::memory_order_acquire);
+    return b - t;
+  }
+
+ private:
+  class Array {
+   public:
+    explicit Array(int64_t capacity)
+        : capacity_(capacity),
+          mask_(capacity - 1),
+          items_(new std::atomic<T*>[capacity]) {}
+
+    int64_t Capacity() const { return capacity_; }
+
+    T* Get(int64_t index) const {
+      return items_[index & mask_].load(std::memory_order_relaxed);
+    }
+
+    void Put(int64_t index, T* item) {
+      items_[index & mask_].store(item, std::memory_order_relaxed);
+    }
+
+    Array* Grow(int64_t bottom, int64_t top) const {
+      Array* array = new Array(capacity_ * 2);
+      for (int64_t i = top; i < bottom; ++i) {
+        array->Put(i, Get(i));
+      }
+      return array;
+    }
+
+   private:
+    const int64_t capacity_;
+    const int64_t mask_;
+    std::unique_ptr<std::atomic<T*>[]> items_;
+  };
+
+  WorkStealingQueue(const WorkStealingQueue&) = delete;
+  WorkStealingQueue& operator=(const WorkStealingQueue&) = delete;
+
+  // Top and bottom are written by different threads, keep them in different
+  // cache lines.
+  std::atomic<int64_t> top_;
+  char padding_[64 - sizeof(std::atomic<int64_t>)];
+  std::atomic<int64_t> bottom_;
+  std::atomic<Array*> array_;
+  std::vector<std::unique_ptr<Array>> arrays_;
+};
+
+}  // namespace bee
+
+#endif  // BEE_WORK_STEALING_QUEUE_H
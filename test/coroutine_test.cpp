@@ -0,0 +1,69 @@
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "io_service.h"
+
+// Only built with C++20, see BEE_ENABLE_COROUTINE.
+#if defined(BEE_HAS_COROUTINE)
+
+namespace bee {
+
+namespace {
+
+struct SleepResult {
+  bool resumed = false;
+  bool ok = true;
+  bool running = true;
+  std::thread::id thread;
+  int32_t failed_schedules = 0;
+};
+
+CoTask<void> SleepThenRetry(IOService* io_service, SleepResult* result) {
+  result->ok = co_await io_service->Sleep(100000);
+  result->running = io_service->Running();
+  result->thread = std::this_thread::get_id();
+  // Awaiting a stopped IOService returns false without suspending.
+  for (int32_t i = 0; i < 100000; ++i) {
+    if (!co_await io_service->Schedule()) {
+      ++result->failed_schedules;
+    }
+  }
+  result->resumed = true;
+}
+
+}  // namespace
+
+TEST(CoroutineTest, ScheduleResumesOnIOService) {
+  IOService io_service;
+  ASSERT_TRUE(io_service.Start());
+  bool ok = false;
+  bool current = false;
+  Completion completion;
+  CoSpawn([](IOService* io_service, bool* ok, bool* current,
+             Completion* completion) -> CoTask<void> {
+    *ok = co_await io_service->Schedule();
+    *current = io_service->IsCurrent();
+    completion->Notify();
+  }(&io_service, &ok, &current, &completion));
+  completion.Wait();
+  EXPECT_TRUE(ok);
+  EXPECT_TRUE(current);
+  io_service.Stop();
+}
+
+TEST(CoroutineTest, StopResumesDroppedCoroutinesAfterJoin) {
+  IOService io_service;
+  ASSERT_TRUE(io_service.Start(2));
+  SleepResult result;
+  CoSpawn(SleepThenRetry(&io_service, &result));
+  io_service.Stop();
+  ASSERT_TRUE(result.resumed);
+  EXPECT_FALSE(result.ok);
+  EXPECT_FALSE(result.running);
+  EXPECT_EQ(std::this_thread::get_id(), result.thread);
+  EXPECT_EQ(100000, result.failed_schedules);
+}
+
+}  // namespace bee
+
+#endif  // BEE_HAS_COROUTINE
@@ -0,0 +1,135 @@
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "io_service_group.h"
+
+namespace bee {
+
+TEST(IOServiceGroupTest, KeyStaysOnOneShardInOrder) {
+  const int32_t kKeys = 32;
+  const int32_t kTasks = 500;
+  IOServiceGroup group(4);
+  ASSERT_TRUE(group.Start());
+
+  std::vector<std::vector<int32_t>> orders(kKeys);
+  std::vector<std::thread::id> threads(kKeys);
+  std::atomic<int32_t> wrong_thread(0);
+  std::atomic<int32_t> executed(0);
+  for (int32_t i = 0; i < kTasks; ++i) {
+    for (int32_t key = 0; key < kKeys; ++key) {
+      IOService* shard = group.ShardOf(key);
+      group.PostTask(key, [&, key, i, shard] {
+        if (!shard->IsCurrent()) {
+          ++wrong_thread;
+        }
+        if (i == 0) {
+          threads[key] = std::this_thread::get_id();
+        } else if (threads[key] != std::this_thread::get_id()) {
+          ++wrong_thread;
+        }
+        orders[key].push_back(i);
+        ++executed;
+      });
+    }
+  }
+  while (executed.load() < kKeys * kTasks) {
+    std::this_thread::yield();
+  }
+  EXPECT_EQ(0, wrong_thread.load());
+  for (int32_t key = 0; key < kKeys; ++key) {
+    ASSERT_EQ(static_cast<size_t>(kTasks), orders[key].size());
+    for (int32_t i = 0; i < kTasks; ++i) {
+      ASSERT_EQ(i, orders[key][i]);
+    }
+  }
+  group.Stop();
+}
+
+TEST(IOServiceGroupTest, KeysSpreadOverShards) {
+  IOServiceGroup group(4);
+  std::vector<int32_t> counts(group.ShardCount(), 0);
+  for (uint64_t key = 0; key < 4000; ++key) {
+    IOService* shard = group.ShardOf(key);
+    for (int32_t i = 0; i < group.ShardCount(); ++i) {
+      if (group.Shard(i) == shard) {
+        ++counts[i];
+      }
+    }
+  }
+  for (int32_t count : counts) {
+    EXPECT_GT(count, 500);
+  }
+  EXPECT_EQ(group.ShardOf(std::string("session")),
+            group.ShardOf(std::string("session")));
+}
+
+TEST(IOServiceGroupTest, IoObjectsLiveOnShardOfKey) {
+  IOServiceGroup group(2);
+  ASSERT_TRUE(group.Start());
+  std::shared_ptr<Timer> timer = group.CreateTimer(7);
+  ASSERT_NE(nullptr, timer);
+  IOService* shard = group.ShardOf(7);
+  Completion fired;
+  std::atomic<bool> on_shard(false);
+  timer->Open(1, false, [&fired, &on_shard, shard] {
+    on_shard = shard->IsCurrent();
+    fired.Notify();
+  });
+  fired.Wait();
+  EXPECT_TRUE(on_shard);
+  timer->Close();
+  timer.reset();
+  group.Stop();
+}
+
+TEST(IOServiceGroupTest, RebalanceKeepsPinnedKeys) {
+  IOServiceGroup group(2);
+  ShardRebalancePolicy policy;
+  policy.interval = 10;
+  policy.persistence = 2;
+  group.SetRebalancePolicy(policy);
+  ASSERT_TRUE(group.Start());
+
+  // Keys all on shard 0, the first one pinned by a live timer.
+  std::vector<uint64_t> keys;
+  for (uint64_t key = 0; keys.size() < 16; ++key) {
+    if (group.ShardOf(key) == group.Shard(0)) {
+      keys.push_back(key);
+    }
+  }
+  std::shared_ptr<Timer> timer = group.CreateTimer(keys[0]);
+  std::atomic<int32_t> wrong_thread(0);
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  while (group.MovedBuckets() == 0 &&
+         std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) {
+    std::atomic<int32_t> pending(static_cast<int32_t>(keys.size()));
+    for (uint64_t key : keys) {
+      IOService* shard = group.ShardOf(key);
+      group.PostTask(key, [&pending, &wrong_thread, shard] {
+        if (!shard->IsCurrent()) {
+          ++wrong_thread;
+        }
+        volatile int32_t sum = 0;
+        for (int32_t i = 0; i < 20000; ++i) {
+          sum = sum + i;
+        }
+        --pending;
+      });
+    }
+    while (pending.load() > 0) {
+      std::this_thread::yield();
+    }
+  }
+  EXPECT_GT(group.MovedBuckets(), 0);
+  EXPECT_EQ(group.Shard(0), group.ShardOf(keys[0]));
+  EXPECT_EQ(0, wrong_thread.load());
+  timer.reset();
+  group.Stop();
+}
+
+}  // namespace bee
@@ -0,0 +1,303 @@
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "io_service.h"
+
+namespace bee {
+
+namespace {
+
+// Block the io_context thread of a single threaded IOService until Open(),
+// so tasks posted meanwhile stay queued.
+class Gate {
+ public:
+  explicit Gate(IOService* io_service) : state_(std::make_shared<State>()) {
+    std::shared_ptr<State> state = state_;
+    io_service->PostTask([state] {
+      state->started.Notify();
+      state->opened.Wait();
+    });
+    state_->started.Wait();
+  }
+  ~Gate() { Open(); }
+
+  void Open() {
+    if (!open_) {
+      open_ = true;
+      state_->opened.Notify();
+    }
+  }
+
+ private:
+  // Held by the gated task too, which may still be in Wait() after Open()
+  // returns and the Gate is deleted.
+  struct State {
+    Completion started;
+    Completion opened;
+  };
+
+  std::shared_ptr<State> state_;
+  bool open_ = false;
+};
+
+// Task posting itself again until the IOService is stopped.
+void PostChain(IOService* io_service, std::shared_ptr<int32_t> token) {
+  io_service->PostTask(
+      [io_service, token] { PostChain(io_service, token); });
+}
+
+}  // namespace
+
+TEST(IOServiceTest, RunsTasksInOrder) {
+  IOService io_service;
+  ASSERT_TRUE(io_service.Start());
+  std::vector<int32_t> order;
+  for (int32_t i = 0; i < 1000; ++i) {
+    io_service.PostTask([&order, i] { order.push_back(i); });
+  }
+  io_service.Invoke<void>([] {});
+  ASSERT_EQ(1000u, order.size());
+  for (int32_t i = 0; i < 1000; ++i) {
+    EXPECT_EQ(i, order[i]);
+  }
+  io_service.Stop();
+}
+
+TEST(IOServiceTest, InvokeReturnsValue) {
+  IOService io_service;
+  ASSERT_TRUE(io_service.Start(2));
+  EXPECT_EQ(42, io_service.Invoke<int32_t>([] { return 42; }));
+  EXPECT_TRUE(io_service.Invoke<bool>([&io_service] {
+    return io_service.IsCurrent();
+  }));
+  io_service.Stop();
+}
+
+TEST(IOServiceTest, CancelPendingTask) {
+  IOService io_service;
+  ASSERT_TRUE(io_service.Start());
+  std::atomic<bool> ran(false);
+  TaskHandle handle;
+  {
+    Gate gate(&io_service);
+    handle = io_service.PostCancelableTask([&ran] { ran = true; });
+    EXPECT_TRUE(handle.Cancel());
+    EXPECT_FALSE(handle.Cancel());
+  }
+  io_service.Invoke<void>([] {});
+  EXPECT_FALSE(ran);
+  io_service.Stop();
+}
+
+TEST(IOServiceTest, CancelFinishedTaskFails) {
+  IOService io_service;
+  ASSERT_TRUE(io_service.Start());
+  std::atomic<bool> ran(false);
+  TaskHandle handle = io_service.PostCancelableTask([&ran] { ran = true; });
+  io_service.Invoke<void>([] {});
+  EXPECT_TRUE(ran);
+  EXPECT_FALSE(handle.Cancel());
+  io_service.Stop();
+  // The handle may outlive the IOService.
+  EXPECT_FALSE(handle.Cancel());
+}
+
+TEST(IOServiceTest, CancelDelayedTask) {
+  IOService io_service;
+  ASSERT_TRUE(io_service.Start());
+  std::atomic<bool> ran(false);
+  TaskHandle handle =
+      io_service.PostCancelableDelayedTask([&ran] { ran = true; }, 20);
+  EXPECT_TRUE(handle.Cancel());
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  io_service.Invoke<void>([] {});
+  EXPECT_FALSE(ran);
+  io_service.Stop();
+}
+
+TEST(IOServiceTest, CancelFiredDelayedTask) {
+  IOService io_service;
+  ASSERT_TRUE(io_service.Start());
+  Completion started;
+  Completion opened;
+  std::atomic<bool> ran(false);
+  // Both fire in one batch, the first one holds the thread so that the
+  // second one waits in the queue.
+  io_service.PostDelayedTask(
+      [&started, &opened] {
+        started.Notify();
+        opened.Wait();
+      },
+      5);
+  TaskHandle handle =
+      io_service.PostCancelableDelayedTask([&ran] { ran = true; }, 5);
+  started.Wait();
+  EXPECT_TRUE(handle.Cancel());
+  EXPECT_FALSE(handle.Cancel());
+  opened.Notify();
+  io_service.Invoke<void>([] {});
+  EXPECT_FALSE(ran);
+  io_service.Stop();
+}
+
+TEST(IOServiceTest, CancelRunningDelayedTaskFails) {
+  IOService io_service;
+  ASSERT_TRUE(io_service.Start());
+  Completion started;
+  Completion opened;
+  TaskHandle handle = io_service.PostCancelableDelayedTask(
+      [&started, &opened] {
+        started.Notify();
+        opened.Wait();
+      },
+      5);
+  started.Wait();
+  EXPECT_FALSE(handle.Cancel());
+  opened.Notify();
+  io_service.Stop();
+}
+
+TEST(IOServiceTest, DelayedTaskRunsAfterDelay) {
+  IOService io_service;
+  ASSERT_TRUE(io_service.Start());
+  Completion done;
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  io_service.PostDelayedTask([&done] { done.Notify(); }, 20);
+  done.Wait();
+  EXPECT_GE(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(19));
+  io_service.Stop();
+}
+
+TEST(IOServiceTest, TryPostTaskRefusesWhenFull) {
+  IOService io_service;
+  TaskQueueLimits limits;
+  limits.max_tasks = 10;
+  io_service.SetQueueLimits(limits);
+  ASSERT_TRUE(io_service.Start());
+  std::atomic<int32_t> ran(0);
+  int32_t accepted = 0;
+  {
+    Gate gate(&io_service);
+    for (int32_t i = 0; i < 20; ++i) {
+      if (io_service.TryPostTask([&ran] { ++ran; })) {
+        ++accepted;
+      }
+    }
+    EXPECT_EQ(10, accepted);
+  }
+  io_service.Invoke<void>([] {});
+  EXPECT_EQ(10, ran.load());
+  // Room again once the queue is drained.
+  EXPECT_TRUE(io_service.TryPostTask([] {}));
+  io_service.Stop();
+  EXPECT_FALSE(io_service.TryPostTask([] {}));
+}
+
+TEST(IOServiceTest, WatermarkCallbacksAlternate) {
+  std::mutex mutex;
+  std::vector<bool> events;
+  IOService io_service;
+  TaskQueueLimits limits;
+  limits.high_watermark = 8;
+  limits.low_watermark = 2;
+  limits.watermark_callback = [&mutex, &events](bool high) {
+    std::lock_guard<std::mutex> lock(mutex);
+    events.push_back(high);
+  };
+  io_service.SetQueueLimits(limits);
+  ASSERT_TRUE(io_service.Start());
+  for (int32_t round = 0; round < 2; ++round) {
+    {
+      Gate gate(&io_service);
+      for (int32_t i = 0; i < 20; ++i) {
+        io_service.PostTask([] {});
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      ASSERT_EQ(static_cast<size_t>(round * 2 + 1), events.size());
+      EXPECT_TRUE(events.back());
+    }
+    io_service.Invoke<void>([] {});
+    std::lock_guard<std::mutex> lock(mutex);
+    ASSERT_EQ(static_cast<size_t>(round * 2 + 2), events.size());
+    EXPECT_FALSE(events.back());
+  }
+  io_service.Stop();
+}
+
+TEST(IOServiceTest, StopRunsTasksOfEveryPriority) {
+  IOService io_service;
+  ASSERT_TRUE(io_service.Start());
+  std::atomic<int32_t> ran(0);
+  {
+    Gate gate(&io_service);
+    // Background tasks run last, and slow enough for Stop() to catch up.
+    for (int32_t i = 0; i < 50; ++i) {
+      io_service.PostTask(
+          [&ran] {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            ++ran;
+          },
+          TASK_PRIORITY_BACKGROUND);
+    }
+    io_service.PostTask([&ran] { ++ran; }, TASK_PRIORITY_HIGH);
+    io_service.PostTask([&ran] { ++ran; }, TASK_PRIORITY_NORMAL);
+    std::thread opener([&gate] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      gate.Open();
+    });
+    EXPECT_TRUE(io_service.Stop());
+    opener.join();
+  }
+  EXPECT_EQ(52, ran.load());
+}
+
+TEST(IOServiceTest, StopDeletesTasksLeft) {
+  IOService io_service;
+  for (int32_t i = 0; i < 10; ++i) {
+    ASSERT_TRUE(io_service.Start());
+    std::shared_ptr<int32_t> token = std::make_shared<int32_t>(0);
+    std::weak_ptr<int32_t> weak_token = token;
+    PostChain(&io_service, std::move(token));
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    EXPECT_TRUE(io_service.Stop());
+    // Nothing queued holds the captures until the next Start().
+    EXPECT_TRUE(weak_token.expired());
+  }
+}
+
+TEST(IOServiceTest, StatsSampleTasks) {
+  const int32_t kIntervals[] = {1, 16};
+  for (int32_t interval : kIntervals) {
+    IOService io_service;
+    io_service.SetStatsEnabled(true);
+    io_service.SetStatsSampleInterval(interval);
+    ASSERT_TRUE(io_service.Start());
+    for (int32_t i = 0; i < 1600; ++i) {
+      io_service.PostTask([] {});
+    }
+    io_service.Invoke<void>([] {});
+    IOServiceStats stats = io_service.GetStats();
+    // The invoke itself may be sampled too.
+    EXPECT_GE(stats.queue_latency.count, 1600u / interval);
+    EXPECT_LE(stats.queue_latency.count, 1600u / interval + 1);
+    io_service.Stop();
+  }
+}
+
+TEST(IOServiceTest, RestartsAfterStop) {
+  IOService io_service;
+  for (int32_t i = 0; i < 3; ++i) {
+    ASSERT_TRUE(io_service.Start(2));
+    EXPECT_EQ(7, io_service.Invoke<int32_t>([] { return 7; }));
+    EXPECT_TRUE(io_service.Stop());
+  }
+}
+
+}  // namespace bee
@@ -0,0 +1,86 @@
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "parallel_for.h"
+
+namespace bee {
+
+TEST(ParallelForTest, CoversEveryIndexOnce) {
+  IOService io_service;
+  ASSERT_TRUE(io_service.Start(3));
+  const size_t kSizes[] = {0, 1, 7, 1000, 100003};
+  const size_t kGrains[] = {0, 1, 64, 100000};
+  for (size_t size : kSizes) {
+    for (size_t grain : kGrains) {
+      std::vector<std::atomic<int32_t>> hits(size);
+      for (auto& hit : hits) {
+        hit = 0;
+      }
+      ParallelFor(&io_service, 0, size, grain, [&hits](size_t b, size_t e) {
+        for (size_t i = b; i < e; ++i) {
+          ++hits[i];
+        }
+      });
+      for (size_t i = 0; i < size; ++i) {
+        ASSERT_EQ(1, hits[i].load()) << "size " << size << " grain " << grain;
+      }
+    }
+  }
+  io_service.Stop();
+}
+
+TEST(ParallelForTest, ReduceFoldsInOrder) {
+  IOService io_service;
+  ASSERT_TRUE(io_service.Start(3));
+  std::string letters = ParallelReduce(
+      &io_service, 0, 26, 3, std::string(),
+      [](size_t begin, size_t end) {
+        std::string result;
+        for (size_t i = begin; i < end; ++i) {
+          result.push_back(static_cast<char>('a' + i));
+        }
+        return result;
+      },
+      [](std::string a, std::string b) { return a + b; });
+  EXPECT_EQ("abcdefghijklmnopqrstuvwxyz", letters);
+
+  int64_t sum = ParallelReduce(
+      &io_service, 10, 100010, 1000, static_cast<int64_t>(0),
+      [](size_t begin, size_t end) {
+        int64_t result = 0;
+        for (size_t i = begin; i < end; ++i) {
+          result += static_cast<int64_t>(i);
+        }
+        return result;
+      },
+      [](int64_t a, int64_t b) { return a + b; });
+  EXPECT_EQ(static_cast<int64_t>(100009) * 100010 / 2 - 45, sum);
+  io_service.Stop();
+}
+
+TEST(ParallelForTest, CallerHelpsFromPoolThread) {
+  // A single threaded pool only progresses if the caller runs the chunks.
+  IOService io_service;
+  ASSERT_TRUE(io_service.Start(1));
+  std::atomic<int32_t> count(0);
+  io_service.Invoke<void>([&io_service, &count] {
+    ParallelFor(&io_service, 0, 100, 1, [&io_service, &count](size_t, size_t) {
+      ParallelFor(&io_service, 0, 10, 1,
+                  [&count](size_t, size_t) { ++count; });
+    });
+  });
+  EXPECT_EQ(1000, count.load());
+  io_service.Stop();
+}
+
+TEST(ParallelForTest, RunsOnCallerIfNotRunning) {
+  IOService io_service;
+  size_t covered = 0;
+  ParallelFor(&io_service, 0, 10, 3,
+              [&covered](size_t begin, size_t end) { covered += end - begin; });
+  EXPECT_EQ(10u, covered);
+}
+
+}  // namespace bee
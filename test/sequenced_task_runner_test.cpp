@@ -0,0 +1,132 @@
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "sequenced_task_runner.h"
+
+namespace bee {
+
+TEST(SequencedTaskRunnerTest, RunsTasksInOrderWithoutOverlap) {
+  const int32_t kRunners = 8;
+  const int32_t kTasks = 2000;
+  IOService io_service;
+  ASSERT_TRUE(io_service.Start(4));
+
+  struct Sequence {
+    std::shared_ptr<SequencedTaskRunner> runner;
+    std::vector<int32_t> order;
+    std::atomic<int32_t> running{0};
+    std::atomic<int32_t> overlaps{0};
+  };
+  std::vector<std::unique_ptr<Sequence>> sequences;
+  for (int32_t i = 0; i < kRunners; ++i) {
+    sequences.emplace_back(new Sequence);
+    sequences.back()->runner = SequencedTaskRunner::Create(&io_service);
+  }
+  for (int32_t i = 0; i < kTasks; ++i) {
+    for (auto& sequence : sequences) {
+      Sequence* s = sequence.get();
+      s->runner->PostTask([s, i] {
+        if (s->running.fetch_add(1) != 0) {
+          ++s->overlaps;
+        }
+        EXPECT_TRUE(s->runner->IsCurrent());
+        s->order.push_back(i);
+        s->running.fetch_sub(1);
+      });
+    }
+  }
+  for (auto& sequence : sequences) {
+    sequence->runner->Invoke<void>([] {});
+    EXPECT_EQ(0, sequence->overlaps.load());
+    ASSERT_EQ(static_cast<size_t>(kTasks), sequence->order.size());
+    for (int32_t i = 0; i < kTasks; ++i) {
+      ASSERT_EQ(i, sequence->order[i]);
+    }
+  }
+  sequences.clear();
+  io_service.Stop();
+}
+
+TEST(SequencedTaskRunnerTest, InvokeFromSingleThreadPool) {
+  IOService io_service;
+  ASSERT_TRUE(io_service.Start(1));
+  std::shared_ptr<SequencedTaskRunner> runner =
+      SequencedTaskRunner::Create(&io_service);
+  std::vector<int32_t> order;
+  io_service.Invoke<void>([&runner, &order] {
+    runner->PostTask([&order] { order.push_back(1); });
+    runner->PostTask([&order] { order.push_back(2); });
+    EXPECT_EQ(3, runner->Invoke<int32_t>([&order, &runner] {
+      EXPECT_TRUE(runner->IsCurrent());
+      order.push_back(3);
+      return 3;
+    }));
+    runner->PostTask([&order] { order.push_back(4); });
+  });
+  runner->Invoke<void>([] {});
+  ASSERT_EQ(4u, order.size());
+  for (int32_t i = 0; i < 4; ++i) {
+    EXPECT_EQ(i + 1, order[i]);
+  }
+  runner.reset();
+  io_service.Stop();
+}
+
+TEST(SequencedTaskRunnerTest, RunnersInvokeEachOther) {
+  IOService io_service;
+  ASSERT_TRUE(io_service.Start(1));
+  std::shared_ptr<SequencedTaskRunner> first =
+      SequencedTaskRunner::Create(&io_service);
+  std::shared_ptr<SequencedTaskRunner> second =
+      SequencedTaskRunner::Create(&io_service);
+  std::atomic<int32_t> count(0);
+  Completion done;
+  for (int32_t i = 0; i < 100; ++i) {
+    first->PostTask([&] {
+      second->PostTask([&count] { ++count; });
+      // Back into the first runner from a task of it, through the second.
+      second->Invoke<void>([&] {
+        ++count;
+        first->Invoke<void>([&count] { ++count; });
+      });
+    });
+    second->PostTask([&] {
+      first->PostTask([&count] { ++count; });
+      first->Invoke<void>([&count] { ++count; });
+    });
+  }
+  first->PostTask([&done] { done.Notify(); });
+  done.Wait();
+  first->Invoke<void>([] {});
+  second->Invoke<void>([] {});
+  EXPECT_EQ(500, count.load());
+  first.reset();
+  second.reset();
+  io_service.Stop();
+}
+
+TEST(SequencedTaskRunnerTest, CancelPendingTask) {
+  IOService io_service;
+  ASSERT_TRUE(io_service.Start());
+  std::shared_ptr<SequencedTaskRunner> runner =
+      SequencedTaskRunner::Create(&io_service);
+  std::atomic<bool> ran(false);
+  Completion started;
+  Completion opened;
+  runner->PostTask([&started, &opened] {
+    started.Notify();
+    opened.Wait();
+  });
+  started.Wait();
+  TaskHandle handle = runner->PostCancelableTask([&ran] { ran = true; });
+  EXPECT_TRUE(handle.Cancel());
+  opened.Notify();
+  runner->Invoke<void>([] {});
+  EXPECT_FALSE(ran);
+  runner.reset();
+  io_service.Stop();
+}
+
+}  // namespace bee
@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "inplace_function.h"
+#include "io_service.h"
+#include "task_node_pool.h"
+#include "unique_function.h"
+
+// Counting allocator, counts heap allocations of the test binary while
+// enabled. Every replaceable form of C++11 is replaced, so that memory is
+// never freed by another allocator than the one it's from, which sanitizers
+// report as a mismatch.
+#if defined(__GNUC__)
+#define TEST_NOINLINE __attribute__((noinline))
+#else
+#define TEST_NOINLINE
+#endif
+
+static std::atomic<bool> g_count_allocations(false);
+static std::atomic<int64_t> g_allocations(0);
+
+TEST_NOINLINE void* operator new(size_t size) {
+  if (g_count_allocations.load(std::memory_order_relaxed)) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+  }
+  void* p = malloc(size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+TEST_NOINLINE void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  if (g_count_allocations.load(std::memory_order_relaxed)) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+  }
+  return malloc(size);
+}
+
+TEST_NOINLINE void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+TEST_NOINLINE void* operator new[](size_t size,
+                                   const std::nothrow_t& tag) noexcept {
+  return operator new(size, tag);
+}
+
+TEST_NOINLINE void operator delete(void* p) noexcept {
+  free(p);
+}
+
+TEST_NOINLINE void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+TEST_NOINLINE void operator delete(void* p, const std::nothrow_t&) noexcept {
+  free(p);
+}
+
+TEST_NOINLINE void operator delete[](void* p) noexcept {
+  free(p);
+}
+
+TEST_NOINLINE void operator delete[](void* p, size_t) noexcept {
+  free(p);
+}
+
+TEST_NOINLINE void operator delete[](void* p, const std::nothrow_t&) noexcept {
+  free(p);
+}
+
+namespace bee {
+
+namespace {
+
+// Count heap allocations in the scope.
+class AllocationCounter {
+ public:
+  AllocationCounter() {
+    g_allocations = 0;
+    g_count_allocations = true;
+  }
+  ~AllocationCounter() { g_count_allocations = false; }
+
+  int64_t Count() const { return g_allocations.load(); }
+};
+
+}  // namespace
+
+TEST(TaskNodePoolTest, ReusesFreedBlocks) {
+  void* first = TaskNodePool::Allocate(100);
+  TaskNodePool::Free(first);
+  AllocationCounter counter;
+  for (int32_t i = 0; i < 1000; ++i) {
+    TaskNodePool::Free(TaskNodePool::Allocate(100));
+  }
+  EXPECT_EQ(0, counter.Count());
+}
+
+TEST(TaskNodePoolTest, FreesBlocksFromOtherThreads) {
+  void* p = TaskNodePool::Allocate(64);
+  std::thread thread([p] { TaskNodePool::Free(p); });
+  thread.join();
+  // The block comes back through the remote list of this thread.
+  AllocationCounter counter;
+  TaskNodePool::Free(TaskNodePool::Allocate(64));
+  EXPECT_EQ(0, counter.Count());
+}
+
+TEST(TaskNodePoolTest, PostTaskDoesNotAllocateAtSteadyState) {
+  const int32_t kBatch = 1000;
+  const int32_t kBatches = 100;
+  IOService io_service;
+  ASSERT_TRUE(io_service.Start());
+
+  std::atomic<int32_t> executed(0);
+  auto post_batches = [&io_service, &executed](int32_t batches) {
+    for (int32_t i = 0; i < batches; ++i) {
+      int32_t target = executed.load() + kBatch;
+      for (int32_t j = 0; j < kBatch; ++j) {
+        io_service.PostTask(
+            [&executed] { executed.fetch_add(1, std::memory_order_relaxed); });
+      }
+      while (executed.load() < target) {
+        std::this_thread::yield();
+      }
+    }
+  };
+
+  post_batches(10);
+  int64_t allocations = 0;
+  {
+    AllocationCounter counter;
+    post_batches(kBatches);
+    allocations = counter.Count();
+  }
+  io_service.Stop();
+  // A few refills of the pool are allowed, not one per task.
+  EXPECT_LE(allocations, kBatch * kBatches / 1000);
+}
+
+TEST(TaskNodePoolTest, SmallFunctorsStayInline) {
+  int32_t value = 0;
+  AllocationCounter counter;
+  UniqueFunction<void()> unique([&value] { ++value; });
+  InplaceFunction<void()> inplace([&value] { ++value; });
+  unique();
+  inplace();
+  EXPECT_EQ(2, value);
+  EXPECT_EQ(0, counter.Count());
+}
+
+}  // namespace bee